@@ -0,0 +1,110 @@
+# Compare building N test files as N executables (header-only Lightest) with
+# building them into one executable linked with the compiled library, either
+# including lightest.h or the slim lightest_lite.h
+# Usage: python build_time.py [files] [tests per file] [baseline revision]
+# With a git revision (e.g. e3123d7), the cost of its lightest.h in a test file
+# is also measured as the baseline
+# The compiler is $CXX or c++
+
+import io
+import os
+import shutil
+import subprocess
+import sys
+import tarfile
+import tempfile
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+filesNum = int(sys.argv[1]) if len(sys.argv) > 1 else 20
+testsNum = int(sys.argv[2]) if len(sys.argv) > 2 else 50
+baseline = sys.argv[3] if len(sys.argv) > 3 else None
+compiler = os.environ.get("CXX", "c++")
+root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+flags = ["-std=c++11", "-O1", "-I" + os.path.join(root, "include")]
+jobs = os.cpu_count() or 1
+
+def Run(command):
+  start = time.time()
+  subprocess.check_call(command)
+  return time.time() - start
+
+# Run the commands parallelly, returning wall time & total time of them
+def RunAll(commands):
+  start = time.time()
+  with ThreadPoolExecutor(jobs) as pool:
+    total = sum(pool.map(Run, commands))
+  return time.time() - start, total
+
+def Size(paths):
+  return sum(os.path.getsize(path) for path in paths)
+
+def Generate(prefix, header):
+  sources = []
+  for i in range(filesNum):
+    source = os.path.join(workDir, prefix + str(i) + ".cpp")
+    with open(source, "w") as file:
+      file.write("#include <lightest/" + header + ">\n")
+      for j in range(testsNum):
+        file.write("TEST(Test_%d_%d) { REQ(%d, ==, %d); }\n" % (i, j, j, j))
+    sources.append(source)
+  return sources
+
+# Build the files & the compiled library into one executable
+def BuildLinked(sources, name):
+  objects = [source[:-4] + ".o" for source in sources]
+  library = os.path.join(workDir, "lightest.o")
+  wall, total = RunAll([[compiler] + flags + ["-DLIGHTEST_LIBRARY", "-c",
+                         source, "-o", obj]
+                        for source, obj in zip(sources, objects)] +
+                       [[compiler] + flags + ["-DLIGHTEST_LIBRARY", "-c",
+                         os.path.join(root, "src", "lightest.cpp"), "-o",
+                         library]])
+  program = os.path.join(workDir, name)
+  linkTime = Run([compiler] + objects + [library, "-o", program, "-pthread"])
+  print("1 executable (%s): %.2f s wall, %.2f s total, %.1f MB" %
+        (name, wall + linkTime, total + linkTime, Size([program]) / 1e6))
+
+workDir = tempfile.mkdtemp()
+sources = Generate("test_", "lightest.h")
+
+# Each test file -> one executable
+executables = [source[:-4] for source in sources]
+wall, total = RunAll([[compiler] + flags + [source, "-o", executable,
+                       "-pthread"]
+                      for source, executable in zip(sources, executables)])
+print("%d executables: %.2f s wall, %.2f s total, %.1f MB" %
+      (filesNum, wall, total, Size(executables) / 1e6))
+
+# All the test files + the compiled library -> one executable
+BuildLinked(sources, "lightest.h")
+BuildLinked(Generate("lite_test_", "lightest_lite.h"), "lightest_lite.h")
+
+# Cost of a test file with a single TEST by the header, with the lines
+# preprocessed from it
+def MeasureHeader(label, header, extraFlags):
+  source = os.path.join(workDir, "single.cpp")
+  with open(source, "w") as file:
+    file.write("#include <lightest/" + header + ">\n")
+    file.write("TEST(Test) { REQ(1, ==, 1); }\n")
+  used = Run([compiler] + flags + extraFlags + ["-c", source, "-o",
+                                                source[:-4] + ".o"])
+  lines = subprocess.check_output([compiler] + flags + extraFlags +
+                                  ["-E", source]).count(b"\n")
+  print("Including %s: %.3f s, %d lines preprocessed" % (label, used, lines))
+
+MeasureHeader("lightest.h", "lightest.h", [])
+MeasureHeader("lightest.h (library)", "lightest.h", ["-DLIGHTEST_LIBRARY"])
+MeasureHeader("lightest_lite.h (library)", "lightest_lite.h",
+              ["-DLIGHTEST_LIBRARY"])
+if baseline is not None:
+  # Headers of the baseline revision take place of the current ones
+  archive = subprocess.check_output(["git", "-C", root, "archive", baseline,
+                                     "include"])
+  baselineDir = os.path.join(workDir, "baseline")
+  with tarfile.open(fileobj=io.BytesIO(archive)) as tar:
+    tar.extractall(baselineDir)
+  flags[-1] = "-I" + os.path.join(baselineDir, "include")
+  MeasureHeader("lightest.h of " + baseline, "lightest.h", [])
+
+shutil.rmtree(workDir)
@@ -0,0 +1,24 @@
+# Measure time of compiling test files into objects, and sizes of the objects
+# Usage: python compile_cost.py compiler [flags] files
+# e.g. python compile_cost.py c++ -std=c++11 -O2 -I../include lightest_test.cpp
+
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+compiler = sys.argv[1]
+flags = [arg for arg in sys.argv[2:] if arg.startswith("-")]
+sources = [arg for arg in sys.argv[2:] if not arg.startswith("-")]
+
+workDir = tempfile.mkdtemp()
+for source in sources:
+  obj = os.path.join(workDir, os.path.basename(source) + ".o")
+  start = time.time()
+  subprocess.check_call([compiler] + flags + ["-c", source, "-o", obj])
+  used = time.time() - start
+  print("%s: %.2f s, %.1f KB" %
+        (os.path.basename(source), used, os.path.getsize(obj) / 1024))
+  os.remove(obj)
+os.rmdir(workDir)
@@ -1,19 +1,30 @@
 # Generate benchmark source file for Lightest with 1000 tests
-lightestTestFile = open("lightest_test.cpp", "w")
+# Usage: python generate_lightest_test.py [tests] [file]
+# e.g. python generate_lightest_test.py 100000 lightest_100k_test.cpp, to
+# measure the startup cost of registering lots of tests by running it with
+# --filter=None, which runs no tests
+import sys
+
+testsNum = int(sys.argv[1]) if len(sys.argv) > 1 else 1000
+fileName = sys.argv[2] if len(sys.argv) > 2 else "lightest_test.cpp"
+lightestTestFile = open(fileName, "w")
 
 lightestTestFile.write("""// Generated by generate_lightest_test.py
 #include <lightest/lightest.h>
+#include <lightest/arg_config_ext.h>
 #include <lightest/data_analysis_ext.h>
 
 // Provide simpler file name
 #undef TEST_FILE_NAME
-#define TEST_FILE_NAME "lightest_test.cpp"
-
 """)
+lightestTestFile.write("#define TEST_FILE_NAME \"" + fileName + "\"\n\n")
+
+# Commandline flags, e.g. --filter=None
+lightestTestFile.write("ARG_CONFIG();\n\n")
 
-# Generate 1000 tests
+# Generate the tests
 # e.g. TEST(Test1) { REQ(1, ==, 1); }
-for i in range(1000):
+for i in range(testsNum):
   lightestTestFile.write("TEST(Test" + str(i + 1) + ") { REQ(" + str(i) + ", ==, " + str(i) + "); }\n")
 
 lightestTestFile.write("""
@@ -1,11 +1,14 @@
 // Generated by generate_lightest_test.py
 #include <lightest/lightest.h>
+#include <lightest/arg_config_ext.h>
 #include <lightest/data_analysis_ext.h>
 
 // Provide simpler file name
 #undef TEST_FILE_NAME
 #define TEST_FILE_NAME "lightest_test.cpp"
 
+ARG_CONFIG();
+
 TEST(Test1) { REQ(0, ==, 0); }
 TEST(Test2) { REQ(1, ==, 1); }
 TEST(Test3) { REQ(2, ==, 2); }
@@ -0,0 +1,409 @@
+// Benchmark of Lightest's own machinery
+#include <lightest/data_analysis_ext.h>
+#include <lightest/lightest.h>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Provide simpler file name
+#undef TEST_FILE_NAME
+#define TEST_FILE_NAME "self_benchmark.cpp"
+
+// Count heap allocations
+size_t allocCount = 0;
+void* operator new(size_t size) {
+  allocCount++;
+  void* ptr = std::malloc(size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+/* ========== Data Tree ========== */
+
+// 1000 tests each with 1000 REQs
+const int testsNum = 1000, reqsNum = 1000;
+typedef lightest::DataReq Req;
+
+// Before: every Data is allocated from heap, kept in a vector, and deleted
+// one by one, as the DataSet used to do
+typedef struct {
+  lightest::DataSet* data;
+  std::vector<lightest::Data*> sons;
+} HeapTest;
+void BuildHeapTree(std::vector<HeapTest>& tests) {
+  for (int i = 0; i < testsNum; i++) {
+    tests.push_back(HeapTest{::new lightest::DataSet("Test"), {}});
+    for (int j = 0; j < reqsNum; j++) {
+      tests.back().sons.push_back(
+          ::new Req("", 0, nullptr, nullptr, "==", "j == j", false));
+    }
+  }
+}
+void DeleteHeapTree(std::vector<HeapTest>& tests) {
+  for (HeapTest& test : tests) {
+    for (lightest::Data* item : test.sons) {
+      item->~Data();
+      ::operator delete(item);
+    }
+    test.data->~DataSet();
+    ::operator delete(test.data);
+  }
+  tests.clear();
+}
+
+// After: all the Data are allocated from an arena and released in one shot
+void BuildArenaTree(lightest::Arena& arena) {
+  for (int i = 0; i < testsNum; i++) {
+    lightest::DataSet* test = new (arena) lightest::DataSet("Test");
+    for (int j = 0; j < reqsNum; j++) {
+      test->Add(
+          new (arena) Req("", 0, nullptr, nullptr, "==", "j == j", false));
+    }
+  }
+}
+
+TEST(BenchDataTree) {
+  std::vector<HeapTest> tests;
+  size_t heapAllocs = allocCount;
+  double heapBuild = TIMER(BuildHeapTree(tests));
+  heapAllocs = allocCount - heapAllocs;
+  double heapTeardown = TIMER(DeleteHeapTree(tests));
+  lightest::Arena arena;
+  size_t arenaAllocs = allocCount;
+  double arenaBuild = TIMER(BuildArenaTree(arena));
+  arenaAllocs = allocCount - arenaAllocs;
+  double arenaTeardown = TIMER(arena.Release());
+  std::cout << "Heap:  " << heapAllocs << " allocations, build " << heapBuild
+            << " ms, teardown " << heapTeardown << " ms" << std::endl;
+  std::cout << "Arena: " << arenaAllocs << " allocations, build "
+            << arenaBuild << " ms, teardown " << arenaTeardown << " ms"
+            << std::endl;
+  REQ(arenaAllocs, <, heapAllocs);
+}
+
+/* ========== Traversal ========== */
+
+// 1000 tests each with 10 sub tests each with 99 sub sub tests, 1M in total
+lightest::DataSet* BuildTestsTree(lightest::Arena& arena) {
+  lightest::DataSet* root = new (arena) lightest::DataSet("");
+  for (int i = 0; i < 1000; i++) {
+    lightest::DataSet* test = new (arena) lightest::DataSet("Test");
+    root->Add(test);
+    for (int j = 0; j < 10; j++) {
+      lightest::DataSet* sub = new (arena) lightest::DataSet("Sub");
+      test->Add(sub);
+      for (int k = 0; k < 99; k++) {
+        sub->Add(new (arena) lightest::DataSet("SubSub"));
+      }
+    }
+  }
+  return root;
+}
+
+// Before: a recursive std::function, with sons iterated through another
+// std::function
+void IterSonsByFunction(const lightest::DataSet* data,
+                        std::function<void(const lightest::Data*)> func) {
+  for (const lightest::Data* item = data->GetFirstSon(); item != nullptr;
+       item = item->GetNext()) {
+    func(item);
+  }
+}
+void IterAllByFunction(const lightest::DataSet* data,
+                       std::function<void(const lightest::DataSet*)> func) {
+  std::function<void(const lightest::Data*)> iterFunc =
+      [&iterFunc, &func](const lightest::Data* item) {
+        if (item->Type() == lightest::DATA_SET) {
+          func(static_cast<const lightest::DataSet*>(item));
+          IterSonsByFunction(static_cast<const lightest::DataSet*>(item),
+                             iterFunc);
+        }
+      };
+  IterSonsByFunction(data, iterFunc);
+}
+
+size_t CountByRange(const lightest::DataSet* root) {
+  size_t num = 0;
+  for (const lightest::DataSet* test : lightest::AllTests(root)) {
+    if (test != nullptr) num++;
+  }
+  return num;
+}
+
+TEST(BenchTraversal) {
+  lightest::Arena arena;
+  const lightest::DataSet* root = BuildTestsTree(arena);
+  size_t functionNum = 0, iterNum = 0, rangeNum = 0;
+  size_t functionAllocs = allocCount;
+  double functionTime = TIMER(IterAllByFunction(
+      root, [&functionNum](const lightest::DataSet*) { functionNum++; }));
+  functionAllocs = allocCount - functionAllocs;
+  size_t iterAllocs = allocCount;
+  double iterTime = TIMER(lightest::IterAllTests(
+      root, [&iterNum](const lightest::DataSet*) { iterNum++; }));
+  iterAllocs = allocCount - iterAllocs;
+  double rangeTime = TIMER(rangeNum = CountByRange(root));
+  std::cout << "Traversing " << iterNum << " tests:" << std::endl;
+  std::cout << "Recursive std::function: " << functionAllocs
+            << " allocations, " << functionTime << " ms" << std::endl;
+  std::cout << "Iterator & template:     " << iterAllocs << " allocations, "
+            << iterTime << " ms" << std::endl;
+  std::cout << "Range-based for:         " << rangeTime << " ms" << std::endl;
+  REQ(iterNum, ==, functionNum);
+  REQ(rangeNum, ==, functionNum);
+}
+
+/* ========== Durations ========== */
+
+// 1000 tests each with 100 sub tests, taking 1 us ~ 1 s
+lightest::DataSet* BuildTimedTree(lightest::Arena& arena) {
+  lightest::DataSet* root = new (arena) lightest::DataSet("");
+  unsigned int seed = 1;
+  for (int i = 0; i < 1000; i++) {
+    lightest::DataSet* test = new (arena) lightest::DataSet("Test");
+    for (int j = 0; j < 100; j++) {
+      lightest::DataSet* sub = new (arena) lightest::DataSet("Sub");
+      seed = seed * 1103515245 + 12345;
+      sub->End(1000LL << (seed >> 16) % 20, 0);
+      test->Add(sub);
+    }
+    test->End(1000000000, 0);
+    root->Add(test);
+  }
+  return root;
+}
+
+// Before: paths & durations of all the tests collected and sorted
+std::vector<lightest::TestDuration> SortAllDurations(
+    const lightest::DataSet* data) {
+  std::vector<lightest::TestDuration> all;
+  const lightest::TestRange tests = lightest::AllTests(data);
+  for (lightest::TestIterator it = tests.begin(); it != tests.end(); ++it) {
+    all.push_back(lightest::TestDuration{(*it)->GetDuration(), it.GetPath()});
+  }
+  std::sort(all.begin(), all.end(),
+            [](const lightest::TestDuration& a,
+               const lightest::TestDuration& b) {
+              return a.duration > b.duration;
+            });
+  return all;
+}
+
+// After: one pass with a bounded heap and a histogram
+void SlowestAndP99(const lightest::DataSet* data, double& slowest,
+                   double& p99) {
+  lightest::DurationStats stats(data, 10);
+  slowest = stats.GetSlowest()[9].duration;
+  p99 = stats.GetPercentile(0.99);
+}
+
+TEST(BenchDurationStats) {
+  lightest::Arena arena;
+  const lightest::DataSet* root = BuildTimedTree(arena);
+  std::vector<lightest::TestDuration> all;
+  size_t sortAllocs = allocCount;
+  double sortTime = TIMER(all = SortAllDurations(root));
+  sortAllocs = allocCount - sortAllocs;
+  double slowest = 0, p99 = 0;
+  size_t statsAllocs = allocCount;
+  double statsTime = TIMER(SlowestAndP99(root, slowest, p99));
+  statsAllocs = allocCount - statsAllocs;
+  std::cout << "Slowest 10 & p99 of " << all.size() << " tests:" << std::endl;
+  std::cout << "Sorting all:       " << sortAllocs << " allocations, "
+            << sortTime << " ms" << std::endl;
+  std::cout << "Heap & histogram:  " << statsAllocs << " allocations, "
+            << statsTime << " ms" << std::endl;
+  REQ(slowest, ==, all[9].duration);
+  REQ(p99, >=, all[all.size() / 100].duration);
+}
+
+/* ========== Teardown ========== */
+
+// Time (ms) from a child process having built the data tree to its exit
+double TimeTeardown(void (*build)(), void (*teardown)()) {
+  lightest::FlushOutput();  // Or the child flushes the outputs again
+  int fds[2];
+  if (pipe(fds) != 0) return -1;
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    build();
+    char built = 1;
+    if (write(fds[1], &built, 1) != 1) _exit(1);
+    teardown();
+  }
+  close(fds[1]);
+  char built;
+  if (read(fds[0], &built, 1) != 1) return -1;
+  long long start = lightest::WallNow();
+  waitpid(pid, nullptr, 0);
+  close(fds[0]);
+  return lightest::NsToMs(lightest::WallNow() - start);
+}
+
+std::vector<HeapTest> heapTests;
+void BuildHeap() { BuildHeapTree(heapTests); }
+void DeleteHeap() {
+  DeleteHeapTree(heapTests);
+  exit(0);
+}
+// As tests do, allocating data from the thread's arena
+void BuildArena() {
+  lightest::DataSet* root = new lightest::DataSet("");
+  for (int i = 0; i < testsNum; i++) {
+    lightest::DataSet* test = new lightest::DataSet("Test");
+    root->Add(test);
+    for (int j = 0; j < reqsNum; j++) {
+      test->Add(new Req("", 0, nullptr, nullptr, "==", "j == j", false));
+    }
+  }
+}
+void ReleaseArena() {
+  lightest::ReleaseArenas();
+  exit(0);
+}
+void FastExit() { lightest::FastExit(0); }
+
+TEST(BenchTeardown) {
+  double heapTime = TimeTeardown(BuildHeap, DeleteHeap);
+  double arenaTime = TimeTeardown(BuildArena, ReleaseArena);
+  double fastTime = TimeTeardown(BuildArena, FastExit);
+  std::cout << "Teardown of " << testsNum * reqsNum << " REQs:" << std::endl;
+  std::cout << "Deleting one by one: " << heapTime << " ms" << std::endl;
+  std::cout << "Releasing arenas:    " << arenaTime << " ms" << std::endl;
+  std::cout << "Fast exit:           " << fastTime << " ms" << std::endl;
+  REQ(fastTime, >=, 0);
+}
+
+/* ========== Registering ========== */
+
+// 100k TESTs registered during static initialization
+const int registeredNum = 100000;
+void CallNothing(lightest::Register::Context& ctx) {}
+
+// Before: every TEST pushed a std::function to a vector
+typedef struct {
+  const char* name;
+  std::function<void(lightest::Register::Context&)> callerFunc;
+} FuncWrapper;
+void RegisterToVector(std::vector<FuncWrapper>& registered) {
+  for (int i = 0; i < registeredNum; i++) {
+    registered.push_back({"Test", CallNothing});
+  }
+}
+
+// After: every TEST links its own node, storage of which is static
+void RegisterToList(lightest::Registering* nodes,
+                    lightest::RegisterList& list) {
+  for (int i = 0; i < registeredNum; i++) {
+    new (nodes + i) lightest::Registering(list, "Test", CallNothing);
+  }
+}
+
+TEST(BenchRegistering) {
+  std::vector<FuncWrapper> registered;
+  size_t vectorAllocs = allocCount;
+  double vectorTime = TIMER(RegisterToVector(registered));
+  vectorAllocs = allocCount - vectorAllocs;
+  // As static storage of the nodes
+  lightest::Registering* nodes = static_cast<lightest::Registering*>(
+      std::malloc(sizeof(lightest::Registering) * registeredNum));
+  lightest::RegisterList list = {nullptr, nullptr, 0};
+  size_t listAllocs = allocCount;
+  double listTime = TIMER(RegisterToList(nodes, list));
+  listAllocs = allocCount - listAllocs;
+  // Taken by the register in main
+  lightest::Register reg;
+  double loadTime = TIMER(reg.Load(list));
+  std::free(nodes);
+  std::cout << "Registering " << registeredNum << " tests:" << std::endl;
+  std::cout << "Vector of functions: " << vectorAllocs << " allocations, "
+            << vectorTime << " ms" << std::endl;
+  std::cout << "Linked nodes:        " << listAllocs << " allocations, "
+            << listTime << " ms, loaded in main " << loadTime << " ms"
+            << std::endl;
+  REQ(reg.GetRegisteredNum(), ==, size_t(registeredNum));
+  REQ(listAllocs, ==, size_t(0));
+}
+
+/* ========== Printing ========== */
+
+// Data of the generated 1000-test suite, each with one passing REQ
+std::vector<std::string> suiteNames;
+lightest::DataSet* BuildSuite(lightest::Arena& arena) {
+  lightest::DataSet* suite = new (arena) lightest::DataSet("");
+  suite->SetTabs(0);
+  for (int i = 0; i < 1000; i++) {
+    suiteNames.push_back("Test" + std::to_string(i + 1));
+  }
+  for (const std::string& name : suiteNames) {
+    lightest::DataSet* test = new (arena) lightest::DataSet(name.c_str());
+    suite->Add(test);
+    test->Add(new (arena) lightest::DataReq("lightest_test.cpp", 1, nullptr,
+                                            nullptr, "==", "0 == 0", false));
+  }
+  return suite;
+}
+
+// Before: every line is flushed, as std::endl did
+class LineFlushingSink : public lightest::StreamSink {
+ public:
+  LineFlushingSink(std::ostream& os) : StreamSink(os) {}
+
+ protected:
+  std::streamsize xsputn(const char* s, std::streamsize n) {
+    StreamSink::xsputn(s, n);
+    if (std::memchr(s, '\n', size_t(n)) != nullptr) Flush();
+    return n;
+  }
+};
+
+const int printRounds = 100;
+
+void PrintSuite(const lightest::DataSet* suite, lightest::OutputSink* sink) {
+  lightest::SetOutputSink(sink);
+  for (int i = 0; i < printRounds; i++) {
+    suite->PrintSons();
+  }
+  lightest::FlushOutput();
+  lightest::SetOutputSink(&lightest::coutSink);
+}
+
+TEST(BenchPrint) {
+  lightest::Arena arena;
+  lightest::DataSet* suite = BuildSuite(arena);
+  std::ostringstream text;
+  lightest::StreamSink textSink(text);
+  PrintSuite(suite, &textSink);
+  double megabytes = double(text.str().size()) / (1 << 20);
+  // Print to /dev/null to only measure the cost of printing
+  std::ofstream file("/dev/null");
+  LineFlushingSink lineSink(file);
+  double lineTime = TIMER(PrintSuite(suite, &lineSink));
+  lightest::StreamSink streamSink(file);
+  double streamTime = TIMER(PrintSuite(suite, &streamSink));
+  int fd = open("/dev/null", O_WRONLY);
+  lightest::FdSink fdSink(fd);
+  double fdTime = TIMER(PrintSuite(suite, &fdSink));
+  close(fd);
+  std::cout << "Printing the 1000-test suite " << printRounds << " times ("
+            << megabytes << " MB):" << std::endl;
+  std::cout << "Flushing lines: " << lineTime << " ms, "
+            << megabytes / lineTime * 1000 << " MB/s" << std::endl;
+  std::cout << "Stream sink:    " << streamTime << " ms, "
+            << megabytes / streamTime * 1000 << " MB/s" << std::endl;
+  std::cout << "Fd sink:        " << fdTime << " ms, "
+            << megabytes / fdTime * 1000 << " MB/s" << std::endl;
+}
@@ -0,0 +1,478 @@
+/*
+This is a Lightest extension, which archives results of runs in a compact
+binary file, and replays archived runs to DATA processors and reports as if the
+tests just ran. Strings are interned, assertions are fixed-size records, and
+every DataSet records where its sons are, so a reader maps the file and builds
+the data with no allocation per node and no copy of strings.
+*/
+
+#ifndef _ARCHIVE_EXT_H_
+#define _ARCHIVE_EXT_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+#include "lightest.h"
+
+// lightest.h undefines its platform macros at its end
+#if defined(__linux__) || defined(__APPLE__)
+#define _ARCHIVE_MMAP_
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace lightest {
+
+/* ========== Format ========== */
+
+// All in native byte order:
+//   ArchiveHeader
+//   ArchiveItem * itemsNum     Sons of DataSets, contiguous for each DataSet
+//   ArchiveSet * setsNum
+//   Strings                    Interned, each ending with '\0'
+// Strings are referred to by their offsets in the strings, noString for none
+
+const char archiveMagic[8] = {'L', 'T', 'A', 'R', 'C', 'H', 0, 1};
+const uint32_t noString = 0xFFFFFFFF;
+
+typedef struct {
+  char magic[8];
+  uint64_t itemsOffset, itemsNum;
+  uint64_t setsOffset, setsNum;
+  uint64_t stringsOffset, stringsSize;
+  uint64_t root;  // Index of the DataSet of the run
+} ArchiveHeader;
+
+// Fields by types:
+//   DATA_SET: index of the DataSet
+//   DATA_REQ: file, line, actual, expected, operator, expression
+//   DATA_UNCAUGHT_ERROR: file, line, message
+//   DATA_TIMEOUT: path, limit
+// Data of other types aren't archived
+typedef struct {
+  uint32_t type, failed;
+  uint32_t fields[6];
+} ArchiveItem;
+
+typedef struct {
+  uint32_t name, firstItem, itemsNum;
+  uint32_t reqsNum, failedReqsNum, failed;
+  int64_t duration, cpuDuration;  // Unit: ns
+} ArchiveSet;
+
+/* ========== Writing ========== */
+
+// Writes data of every TEST when they are added to the results, so TESTs
+// freed early are archived too. Only DataSets and strings are kept until the
+// end of the run
+// The file is created with the first data, after a replay has read its archive
+class ArchiveWriter : public Listener {
+ public:
+  ArchiveWriter() : file(nullptr), itemsNum(0) {}
+  void Open(const string& fileName) {
+    if (!this->fileName.empty()) return;
+    this->fileName = fileName;
+    AddListener(this);
+  }
+  // Write nothing, e.g. when replaying the archive to be written
+  void Cancel() { fileName.clear(); }
+  const string& GetFileName() const { return fileName; }
+  void OnTestData(const DataSet* data) {
+    lock_guard<mutex> lock(writeLock);
+    if (!Create()) return;
+    tests.push_back(NewSet());
+    WriteSet(data, tests.back());
+  }
+  void OnRunEnd(const DataSet* data) {
+    lock_guard<mutex> lock(writeLock);
+    if (!Create()) return;
+    ArchiveHeader header;
+    memcpy(header.magic, archiveMagic, sizeof(archiveMagic));
+    header.itemsOffset = sizeof(ArchiveHeader);
+    // The DataSet of the run gets its sons from the archived TESTs, for the
+    // data of TESTs may be freed early
+    header.root = NewSet();
+    ArchiveSet& root = sets[header.root];
+    root = SetOf(data);
+    root.firstItem = itemsNum, root.itemsNum = uint32_t(tests.size());
+    root.reqsNum = root.failedReqsNum = 0;
+    SortTests();
+    for (uint32_t test : tests) {
+      ArchiveItem item = ArchiveItem();
+      item.type = DATA_SET, item.failed = sets[test].failed;
+      item.fields[0] = test;
+      root.failed = root.failed || item.failed;
+      WriteItem(item);
+    }
+    header.itemsNum = itemsNum;
+    header.setsOffset = header.itemsOffset + itemsNum * sizeof(ArchiveItem);
+    header.setsNum = sets.size();
+    file->write(reinterpret_cast<const char*>(sets.data()),
+                sets.size() * sizeof(ArchiveSet));
+    header.stringsOffset =
+        header.setsOffset + sets.size() * sizeof(ArchiveSet);
+    header.stringsSize = strings.size();
+    file->write(strings.data(), strings.size());
+    file->seekp(0);
+    file->write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file->close();
+  }
+
+ private:
+  bool Create() {
+    if (file != nullptr) return true;
+    if (fileName.empty()) return false;  // Canceled
+    // Never deleted, so that forked workers exiting won't flush their copies
+    // of the buffer to the file
+    file = new ofstream(fileName, ios::binary | ios::trunc);
+    if (!file->is_open()) {
+      cerr << "lightest: cannot open " << fileName << endl;
+      exit(1);
+    }
+    ArchiveHeader header = ArchiveHeader();
+    file->write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file->flush();
+    return true;
+  }
+  uint32_t NewSet() {
+    sets.push_back(ArchiveSet());
+    return uint32_t(sets.size() - 1);
+  }
+  // Put TESTs ending in any order back in registration order, as the results
+  // of parallel runs are
+  void SortTests() {
+    unordered_map<string, size_t> order;
+    for (size_t i = 0; i < globalRegisterTest.GetRegisteredNum(); i++) {
+      order[globalRegisterTest.GetName(i)] = i;
+    }
+    vector<pair<size_t, uint32_t>> sorted;
+    for (uint32_t test : tests) {
+      unordered_map<string, size_t>::const_iterator item =
+          order.find(strings.data() + sets[test].name);
+      sorted.push_back(
+          make_pair(item == order.end() ? order.size() : item->second, test));
+    }
+    stable_sort(
+        sorted.begin(), sorted.end(),
+        [](const pair<size_t, uint32_t>& a, const pair<size_t, uint32_t>& b) {
+          return a.first < b.first;
+        });
+    for (size_t i = 0; i < tests.size(); i++) tests[i] = sorted[i].second;
+  }
+  ArchiveSet SetOf(const DataSet* data) {
+    ArchiveSet set = ArchiveSet();
+    set.name = Intern(data->GetName());
+    set.reqsNum = data->GetReqsNum();
+    set.failedReqsNum = data->GetFailedReqsNum();
+    set.failed = data->GetFailed();
+    set.duration = llround(data->GetDuration() * 1e6);
+    set.cpuDuration = llround(data->GetCpuDuration() * 1e6);
+    return set;
+  }
+  // Write sons of a DataSet contiguously, and then sons of its sub DataSets
+  void WriteSet(const DataSet* data, uint32_t index) {
+    ArchiveSet set = SetOf(data);
+    set.firstItem = itemsNum;
+    vector<pair<const DataSet*, uint32_t>> subs;
+    data->IterSons([this, &subs](const Data* son) {
+      ArchiveItem item = ArchiveItem();
+      item.type = son->Type(), item.failed = son->GetFailed();
+      uint32_t* fields = item.fields;
+      switch (son->Type()) {
+        case DATA_SET:
+          fields[0] = NewSet();
+          subs.push_back(
+              make_pair(static_cast<const DataSet*>(son), fields[0]));
+          break;
+        case DATA_REQ: {
+          const DataReq* req = static_cast<const DataReq*>(son);
+          fields[0] = Intern(req->GetFileName()), fields[1] = req->GetLine();
+          fields[2] = Intern(req->GetActual());
+          fields[3] = Intern(req->GetExpected());
+          fields[4] = Intern(req->GetOperator());
+          fields[5] = Intern(req->GetExpr());
+          break;
+        }
+        case DATA_UNCAUGHT_ERROR: {
+          const DataUncaughtError* error =
+              static_cast<const DataUncaughtError*>(son);
+          fields[0] = Intern(error->GetFileName());
+          fields[1] = error->GetLine();
+          fields[2] = Intern(error->GetErrorMsg());
+          break;
+        }
+        case DATA_TIMEOUT: {
+          const DataTimeout* timeout = static_cast<const DataTimeout*>(son);
+          fields[0] = Intern(timeout->GetPath());
+          fields[1] = timeout->GetLimit();
+          break;
+        }
+        default:
+          return;
+      }
+      WriteItem(item);
+    });
+    set.itemsNum = itemsNum - set.firstItem;
+    sets[index] = set;
+    for (const pair<const DataSet*, uint32_t>& sub : subs) {
+      WriteSet(sub.first, sub.second);
+    }
+  }
+  void WriteItem(const ArchiveItem& item) {
+    file->write(reinterpret_cast<const char*>(&item), sizeof(item));
+    itemsNum++;
+  }
+  uint32_t Intern(const char* str) {
+    if (str == nullptr) return noString;
+    pair<unordered_map<string, uint32_t>::iterator, bool> interned =
+        internedStrings.insert(make_pair(string(str), 0));
+    if (interned.second) {
+      interned.first->second = uint32_t(strings.size());
+      strings.append(str, strlen(str) + 1);
+    }
+    return interned.first->second;
+  }
+  string fileName;
+  ofstream* file;
+  uint32_t itemsNum;
+  vector<ArchiveSet> sets;
+  vector<uint32_t> tests;  // Indexes of DataSets of TESTs
+  unordered_map<string, uint32_t> internedStrings;
+  string strings;
+  mutex writeLock;
+};
+LIGHTEST_EXTERN ArchiveWriter archiveWriter;
+
+/* ========== Reading ========== */
+
+// Maps an archive file, and builds its data in the arena of the thread
+// Strings of the data point into the mapped file, so they're valid until the
+// reader is destroyed
+class ArchiveReader {
+ public:
+  ArchiveReader() : begin(nullptr), size(0) {}
+  // Return nullptr if the file can't be read, with the reason in GetError()
+  DataSet* Read(const string& fileName) {
+    if (!Map(fileName)) return Fail("can't read the file");
+    if (size < sizeof(ArchiveHeader)) return Fail("too small");
+    const ArchiveHeader& header =
+        *reinterpret_cast<const ArchiveHeader*>(begin);
+    if (memcmp(header.magic, archiveMagic, sizeof(archiveMagic)) != 0) {
+      return Fail("not an archive of this version");
+    }
+    if (!InFile(header.itemsOffset, header.itemsNum, sizeof(ArchiveItem)) ||
+        !InFile(header.setsOffset, header.setsNum, sizeof(ArchiveSet)) ||
+        !InFile(header.stringsOffset, header.stringsSize, 1) ||
+        header.root >= header.setsNum || header.stringsSize == 0 ||
+        begin[header.stringsOffset + header.stringsSize - 1] != '\0') {
+      return Fail("corrupted");
+    }
+    items = reinterpret_cast<const ArchiveItem*>(begin + header.itemsOffset);
+    itemsNum = header.itemsNum;
+    sets = reinterpret_cast<const ArchiveSet*>(begin + header.setsOffset);
+    setsNum = header.setsNum;
+    strings = begin + header.stringsOffset;
+    stringsSize = header.stringsSize;
+    // Data of each type are constructed in one array
+    reqsNum = errorsNum = timeoutsNum = 0;
+    for (size_t i = 0; i < itemsNum; i++) {
+      if (items[i].type == DATA_REQ) reqsNum++;
+      if (items[i].type == DATA_UNCAUGHT_ERROR) errorsNum++;
+      if (items[i].type == DATA_TIMEOUT) timeoutsNum++;
+    }
+    Arena& arena = ThreadArena();
+    dataSets =
+        static_cast<DataSet*>(arena.Allocate(sizeof(DataSet) * setsNum));
+    dataReqs =
+        static_cast<DataReq*>(arena.Allocate(sizeof(DataReq) * reqsNum));
+    dataErrors = static_cast<DataUncaughtError*>(
+        arena.Allocate(sizeof(DataUncaughtError) * errorsNum));
+    dataTimeouts = static_cast<DataTimeout*>(
+        arena.Allocate(sizeof(DataTimeout) * timeoutsNum));
+    reqsNum = errorsNum = timeoutsNum = 0;
+    built.assign(setsNum, false);
+    DataSet* root = Build(size_t(header.root), 0);
+    if (root == nullptr) return Fail("corrupted");
+    return root;
+  }
+  const string& GetError() const { return error; }
+  ~ArchiveReader() { Unmap(); }
+
+ private:
+  bool Map(const string& fileName) {
+    Unmap();
+#ifdef _ARCHIVE_MMAP_
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) < 0 || info.st_size == 0) {
+      close(fd);
+      return false;
+    }
+    void* mapped = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE,
+                        fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return false;
+    begin = static_cast<const char*>(mapped), size = size_t(info.st_size);
+#else
+    ifstream file(fileName, ios::binary);
+    if (!file) return false;
+    buffer.assign(istreambuf_iterator<char>(file),
+                  istreambuf_iterator<char>());
+    begin = buffer.data(), size = buffer.size();
+#endif
+    return true;
+  }
+  void Unmap() {
+#ifdef _ARCHIVE_MMAP_
+    if (begin != nullptr) munmap(const_cast<char*>(begin), size);
+#endif
+    begin = nullptr, size = 0;
+  }
+  DataSet* Fail(const char* reason) {
+    error = reason;
+    return nullptr;
+  }
+  bool InFile(uint64_t offset, uint64_t num, size_t unit) const {
+    return offset <= size && num <= (size - offset) / unit;
+  }
+  // Return nullptr for invalid offsets, or a string ending within strings
+  const char* String(uint32_t offset) const {
+    if (offset == noString) return nullptr;
+    return offset < stringsSize ? strings + offset : nullptr;
+  }
+  // Build a DataSet and its sons, nullptr if the archive is corrupted
+  DataSet* Build(size_t index, unsigned int tabs) {
+    if (index >= setsNum || built[index]) return nullptr;  // Loops
+    built[index] = true;
+    const ArchiveSet& record = sets[index];
+    const char* name = String(record.name);
+    if (name == nullptr ||
+        uint64_t(record.firstItem) + record.itemsNum > itemsNum) {
+      return nullptr;
+    }
+    DataSet* set = ::new (&dataSets[index]) DataSet(name);
+    set->SetTabs(tabs);
+    for (size_t i = record.firstItem; i < record.firstItem + record.itemsNum;
+         i++) {
+      const ArchiveItem& item = items[i];
+      const uint32_t* fields = item.fields;
+      Data* son = nullptr;
+      switch (item.type) {
+        case DATA_SET:
+          son = Build(fields[0], tabs + 1);
+          break;
+        case DATA_REQ:
+          if (String(fields[0]) == nullptr || String(fields[4]) == nullptr ||
+              String(fields[5]) == nullptr) {
+            break;
+          }
+          son = ::new (&dataReqs[reqsNum++])
+              DataReq(String(fields[0]), fields[1], String(fields[2]),
+                      String(fields[3]), String(fields[4]), String(fields[5]),
+                      item.failed != 0);
+          break;
+        case DATA_UNCAUGHT_ERROR:
+          if (String(fields[0]) == nullptr || String(fields[2]) == nullptr) {
+            break;
+          }
+          son = ::new (&dataErrors[errorsNum++]) DataUncaughtError(
+              String(fields[0]), fields[1], String(fields[2]));
+          break;
+        case DATA_TIMEOUT:
+          if (String(fields[0]) == nullptr) break;
+          son = ::new (&dataTimeouts[timeoutsNum++])
+              DataTimeout(String(fields[0]), fields[1]);
+          break;
+      }
+      if (son == nullptr) return nullptr;
+      set->Add(son);
+    }
+    // Passing REQs which weren't recorded, and failing data not archived
+    if (record.reqsNum > set->GetReqsNum()) {
+      set->AddPassedReqs(record.reqsNum - set->GetReqsNum());
+    }
+    if (record.failed && !set->GetFailed()) set->MarkFailed();
+    set->End(record.duration, record.cpuDuration);
+    return set;
+  }
+  const char* begin;
+  size_t size;
+  const ArchiveItem* items;
+  const ArchiveSet* sets;
+  const char* strings;
+  size_t itemsNum, setsNum, stringsSize;
+  DataSet* dataSets;
+  DataReq* dataReqs;
+  DataUncaughtError* dataErrors;
+  DataTimeout* dataTimeouts;
+  size_t reqsNum, errorsNum, timeoutsNum;
+  vector<bool> built;
+  string error;
+#ifndef _ARCHIVE_MMAP_
+  vector<char> buffer;
+#endif
+};
+
+/* ========== Replaying ========== */
+
+LIGHTEST_EXTERN string replayFile;  // Use REPLAY(file) to set
+LIGHTEST_EXTERN ArchiveReader replayReader;
+
+// Whether two paths are of the same file
+inline bool SameFile(const string& a, const string& b) {
+#ifdef _ARCHIVE_MMAP_
+  struct stat infoA, infoB;
+  if (stat(a.c_str(), &infoA) == 0 && stat(b.c_str(), &infoB) == 0) {
+    return infoA.st_dev == infoB.st_dev && infoA.st_ino == infoB.st_ino;
+  }
+#endif
+  return a == b;
+}
+
+// Runner of TESTs giving data of the TESTs in the archive instead of running
+inline void Replay(Register& reg) {
+  // Archiving the replayed run into its archive would truncate what's read,
+  // while it would write the same data
+  if (!archiveWriter.GetFileName().empty() &&
+      SameFile(archiveWriter.GetFileName(), replayFile)) {
+    archiveWriter.Cancel();
+  }
+  DataSet* archived = replayReader.Read(replayFile);
+  if (archived == nullptr) {
+    reg.testData->Add(new DataUncaughtError(
+        replayFile.c_str(), 0,
+        CopyToArena("Can't replay the archive, " + replayReader.GetError())));
+    return;
+  }
+  archived->MoveSons(reg.testData);
+  reg.testData->IterSons([](const Data* item) {
+    NotifyTestData(static_cast<const DataSet*>(item));
+  });
+}
+
+inline void SetReplay(const string& file) {
+  replayFile = file;
+  testsRunner = Replay;
+}
+
+// Commandline flags for ARG_CONFIG()
+inline void MatchArchiveFlag(const string& flag, const char* value) {
+  if (flag == "--archive") archiveWriter.Open(value);
+  if (flag == "--replay") SetReplay(value);
+}
+LIGHTEST_EXTERN FlagRegistering archiveFlags
+    LIGHTEST_INIT(("--archive= --replay=", MatchArchiveFlag));
+
+};  // namespace lightest
+
+#define ARCHIVE(file) lightest::archiveWriter.Open(file);
+#define REPLAY(file) lightest::SetReplay(file);
+
+#undef _ARCHIVE_MMAP_
+
+#endif
@@ -1,6 +1,8 @@
 /*
 This is a Lightest extension, which provides a shortcut to resolve commandline
 configuration to Lightest configuration.
+Flags of other extensions are registered by the extensions themselves, so they
+work once the extensions are included.
 */
 
 #ifndef _ARG_CONFIG_H_
@@ -8,23 +10,101 @@ configuration to Lightest configuration.
 
 #include <string>  // Compare string more easily
 #include "lightest.h"
+#include "parallel_ext.h"
+#include "shard_ext.h"
+#include "timeout_ext.h"
 
 namespace lightest {
 
-void MatchArgConfig(std::string arg) {
-  if (arg == "--no-color" || arg == "-nc") NO_COLOR();
-  if (arg == "--no-output" || arg == "-no") NO_OUTPUT();
-  if (arg == "--return-zero" || arg == "--return-0" || arg == "-r0")
+// Resolve flags of the core and the extensions included above
+inline void MatchArgConfigFlag(const std::string& flag, const char* value) {
+  const char* name = flag.c_str();
+  if (flag == "--no-color" || flag == "-nc") NO_COLOR();
+  if (flag == "--no-output" || flag == "-no") NO_OUTPUT();
+  if (flag == "--return-zero" || flag == "--return-0" || flag == "-r0")
     RETURN_ZERO();
+  if (flag == "--parallel-sub" || flag == "-ps") PARALLEL_SUB();
+  if (flag == "--tsc") USE_TSC();
+  if (flag == "--list") LIST_TESTS();
+  if (flag == "--fast-exit") FAST_EXIT();
+  // Invalid counts, e.g. --jobs -1, end the program with code 1
+  if (flag == "--jobs" || flag == "-j")
+    PARALLEL(ParseCount(name, value, maxJobs));
+  if (flag == "--timeout") DEFAULT_TIMEOUT(ParseCount(name, value));
+  if (flag == "--filter") FILTER(value);
+  if (flag == "--exclude") EXCLUDE(value);
+  if (flag == "--shard-index")
+    lightest::shardIndex = ParseCount(name, value, shardUnset - 1);
+  if (flag == "--shard-count")
+    lightest::shardCount = ParseCount(name, value, shardUnset - 1);
+  if (flag == "--shard-durations") SHARD_DURATIONS(value);
+  if (flag == "--save-durations") SAVE_DURATIONS(value);
+  if (flag == "--record") {
+    if (std::string(value) != "failures" && std::string(value) != "all") {
+      cerr << "lightest: invalid --record '" << value << "'" << endl;
+      exit(1);
+    }
+    lightest::recordFailuresOnly = std::string(value) == "failures";
+  }
 }
+LIGHTEST_EXTERN FlagRegistering argConfigFlags LIGHTEST_INIT(
+    ("--no-color -nc --no-output -no --return-zero --return-0 -r0 "
+     "--parallel-sub -ps --tsc --list --fast-exit --jobs= -j= --timeout= "
+     "--filter= --exclude= --shard-index= --shard-count= --shard-durations= "
+     "--save-durations= --record=",
+     MatchArgConfigFlag));
 
-};  // namespace lightest
+// Find the handler of a registered flag, and whether the flag takes a value
+inline FlagHandler FindFlag(const std::string& flag, bool& takesValue) {
+  for (const FlagHandling& handling : FlagHandlings()) {
+    for (const char* name = handling.names; *name != '\0';) {
+      size_t length = strcspn(name, " ");
+      takesValue = length > 0 && name[length - 1] == '=';
+      if (flag.compare(0, std::string::npos, name,
+                       takesValue ? length - 1 : length) == 0) {
+        return handling.handler;
+      }
+      name += length;
+      name += strspn(name, " ");
+    }
+  }
+  return nullptr;
+}
 
-#define ARG_CONFIG()                                \
-  CONFIG(ArgConfiguration) {                        \
-    for (; argn > 0; argn--, argc++) {              \
-      lightest::MatchArgConfig(std::string(*argc)); \
-    }                                               \
+// Resolve the arguments after the program name. A value is given after '='
+// (e.g. --jobs=4) or as the next argument (e.g. --jobs 4), for every flag
+// taking a value. A flag missing its value, or given a value it doesn't take,
+// ends the program with code 1, while unknown arguments are left for other
+// configurations
+inline void MatchArgConfig(int argn, char** argc) {
+  for (int i = 1; i < argn; i++) {
+    std::string arg = argc[i];
+    if (arg.size() < 2 || arg[0] != '-') continue;
+    std::string::size_type equal = arg.find('=');
+    std::string flag = arg.substr(0, equal);
+    bool takesValue;
+    FlagHandler handler = FindFlag(flag, takesValue);
+    if (handler == nullptr) continue;
+    std::string value;
+    if (equal != std::string::npos) {
+      value = arg.substr(equal + 1);
+    } else if (takesValue && i + 1 < argn) {
+      value = argc[++i];
+    } else if (takesValue) {
+      cerr << "lightest: missing value of " << flag << endl;
+      exit(1);
+    }
+    if (!takesValue && equal != std::string::npos) {
+      cerr << "lightest: " << flag << " takes no value" << endl;
+      exit(1);
+    }
+    handler(flag, takesValue ? value.c_str() : nullptr);
   }
+}
+
+};  // namespace lightest
+
+#define ARG_CONFIG() \
+  CONFIG(ArgConfiguration) { lightest::MatchArgConfig(argn, argc); }
 
-#endif
\ No newline at end of file
+#endif
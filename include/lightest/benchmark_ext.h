@@ -0,0 +1,412 @@
+/*
+This is a Lightest extension, which provides microbenchmarks registered like
+tests, with warmup, automatic iteration counts and statistics.
+*/
+
+#ifndef _BENCHMARK_EXT_H_
+#define _BENCHMARK_EXT_H_
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include "lightest.h"
+
+namespace lightest {
+
+/* ========== Configurations ========== */
+
+// ms, use BENCH_TARGET_TIME(ms) to set
+LIGHTEST_EXTERN double benchTargetTime LIGHTEST_INIT(= 500);
+// ms, use BENCH_WARMUP_TIME(ms) to set
+LIGHTEST_EXTERN double benchWarmupTime LIGHTEST_INIT(= 50);
+// Use BENCH_SAMPLES(n) to set, at least 1
+LIGHTEST_EXTERN unsigned int benchSamplesNum LIGHTEST_INIT(= 50);
+
+// Use BENCH_BASELINE(file) to compare results with a baseline file, and
+// SAVE_BENCH_BASELINE(file) to write results to a baseline file
+LIGHTEST_EXTERN string benchBaselineFile, saveBenchBaselineFile;
+// A benchmark regresses if its median gets slower by the threshold ratio, and
+// the slowdown is significant at the alpha level
+// Use REGRESSION_THRESHOLD(ratio) to set
+LIGHTEST_EXTERN double regressionThreshold LIGHTEST_INIT(= 0.05);
+// Use REGRESSION_ALPHA(alpha) to set
+LIGHTEST_EXTERN double regressionAlpha LIGHTEST_INIT(= 0.01);
+
+/* ========== Optimization Barriers ========== */
+
+// Force the compiler to regard the value as used, so the computation of it
+// won't be optimized away
+template <typename T>
+void DoNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  // Read it through a volatile pointer, which can't be optimized away
+  static volatile const void* sink;
+  sink = &value;
+  (void)*static_cast<const volatile char*>(sink);
+#endif
+}
+
+// Force the compiler to finish all the pending writes to memory
+inline void ClobberMemory() {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : : "memory");
+#else
+  atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+/* ========== Data ========== */
+
+// Data class of a benchmark
+// Samples are average time (ns) per iteration of each round, kept in the
+// arena for further analysis
+class DataBench : public Data, public DataUnit {
+ public:
+  DataBench(const char* file_, unsigned int line_, double* samples_,
+            unsigned int samplesNum_, unsigned long long iterations_)
+      : DataUnit(file_, line_),
+        samples(samples_),
+        samplesNum(samplesNum_),
+        iterations(iterations_) {
+    sort(samples, samples + samplesNum);
+    double sum = 0;
+    for (unsigned int i = 0; i < samplesNum; i++) sum += samples[i];
+    mean = sum / samplesNum;
+    double squareSum = 0;
+    for (unsigned int i = 0; i < samplesNum; i++) {
+      squareSum += (samples[i] - mean) * (samples[i] - mean);
+    }
+    stddev = samplesNum > 1 ? sqrt(squareSum / (samplesNum - 1)) : 0;
+    median = samplesNum % 2 ? samples[samplesNum / 2]
+                            : (samples[samplesNum / 2 - 1] +
+                               samples[samplesNum / 2]) / 2;
+    // Nearest-rank percentile
+    p99 = samples[(unsigned int)ceil(samplesNum * 0.99) - 1];
+  }
+  void Print() const {
+    PrintTabs();
+    PRINT_LABEL(Color::Blue, " BENCH ");
+    Output() << " " << file << ":" << line << ": " << samplesNum
+             << " samples x " << iterations << " iterations\n";
+    PrintTabs() << "    └─── mean " << mean << " ns, median " << median
+                << " ns, stddev " << stddev << " ns, min " << GetMin()
+                << " ns, p99 " << p99 << " ns\n";
+  }
+  DataType Type() const { return DATA_BENCH; }
+  const bool GetFailed() const { return false; }
+  // Unit: ns per iteration
+  double GetMean() const { return mean; }
+  double GetMedian() const { return median; }
+  double GetStddev() const { return stddev; }
+  double GetMin() const { return samples[0]; }
+  double GetP99() const { return p99; }
+  // Sorted samples
+  const double* GetSamples() const { return samples; }
+  unsigned int GetSamplesNum() const { return samplesNum; }
+  unsigned long long GetIterations() const { return iterations; }
+
+ private:
+  double* samples;
+  unsigned int samplesNum;
+  unsigned long long iterations;  // Iterations per sample
+  double mean, median, stddev, p99;
+};
+
+// Data class of a regression against the baseline, failing the benchmark
+class DataBenchRegression : public Data, public DataUnit {
+ public:
+  DataBenchRegression(const char* file_, unsigned int line_,
+                      double baselineMedian_, double median_, double p_)
+      : DataUnit(file_, line_),
+        baselineMedian(baselineMedian_),
+        median(median_),
+        p(p_) {}
+  void Print() const {
+    PrintTabs();
+    PRINT_LABEL(Color::Red, " FAIL  ");
+    Output() << " " << file << ":" << line << ": Regressed by "
+             << (median / baselineMedian - 1) * 100 << "%\n";
+    PrintTabs() << "    └─── median " << baselineMedian << " ns => " << median
+                << " ns, p = " << p << "\n";
+  }
+  DataType Type() const { return DATA_BENCH_REGRESSION; }
+  const bool GetFailed() const { return true; }
+  double GetBaselineMedian() const { return baselineMedian; }
+  double GetMedian() const { return median; }
+  double GetP() const { return p; }
+  Failure GetFailure() const {
+    ostringstream message;
+    message << "Regressed by " << (median / baselineMedian - 1) * 100
+            << "%, median " << baselineMedian << " ns => " << median
+            << " ns, p = " << p;
+    return Failure{"REGRESSION", message.str(), file, line};
+  }
+
+ private:
+  double baselineMedian, median, p;
+};
+
+// Codecs to send benchmarks between processes, e.g. from isolated workers
+inline void EncodeBench(const Data* data, Encoder& encoder) {
+  const DataBench* bench = static_cast<const DataBench*>(data);
+  encoder.PutString(bench->GetFileName());
+  encoder.Put<unsigned int>(bench->GetLine());
+  encoder.Put<unsigned int>(bench->GetSamplesNum());
+  for (unsigned int i = 0; i < bench->GetSamplesNum(); i++) {
+    encoder.Put<double>(bench->GetSamples()[i]);
+  }
+  encoder.Put<unsigned long long>(bench->GetIterations());
+}
+inline Data* DecodeBench(Decoder& decoder) {
+  const char* file = decoder.GetString();
+  unsigned int line = decoder.Get<unsigned int>();
+  unsigned int samplesNum = decoder.Get<unsigned int>();
+  double* samples = static_cast<double*>(
+      ThreadArena().Allocate(sizeof(double) * samplesNum));
+  for (unsigned int i = 0; i < samplesNum; i++) {
+    samples[i] = decoder.Get<double>();
+  }
+  return new DataBench(file, line, samples, samplesNum,
+                       decoder.Get<unsigned long long>());
+}
+inline void EncodeBenchRegression(const Data* data, Encoder& encoder) {
+  const DataBenchRegression* regression =
+      static_cast<const DataBenchRegression*>(data);
+  encoder.PutString(regression->GetFileName());
+  encoder.Put<unsigned int>(regression->GetLine());
+  encoder.Put<double>(regression->GetBaselineMedian());
+  encoder.Put<double>(regression->GetMedian());
+  encoder.Put<double>(regression->GetP());
+}
+inline Data* DecodeBenchRegression(Decoder& decoder) {
+  const char* file = decoder.GetString();
+  unsigned int line = decoder.Get<unsigned int>();
+  double baselineMedian = decoder.Get<double>();
+  double median = decoder.Get<double>();
+  return new DataBenchRegression(file, line, baselineMedian, median,
+                                 decoder.Get<double>());
+}
+LIGHTEST_EXTERN CodecRegistering benchCodec LIGHTEST_INIT(
+    (DATA_BENCH, DataCodec{EncodeBench, DecodeBench}));
+LIGHTEST_EXTERN CodecRegistering benchRegressionCodec LIGHTEST_INIT(
+    (DATA_BENCH_REGRESSION,
+     DataCodec{EncodeBenchRegression, DecodeBenchRegression}));
+
+/* ========== Baseline ========== */
+
+// One-sided Mann-Whitney U test: the p-value of samples being no greater than
+// baseline samples, by normal approximation with tie correction
+inline double MannWhitneyP(const double* samples, unsigned int samplesNum,
+                           const double* baseline, unsigned int baselineNum) {
+  vector<pair<double, bool>> all;  // Value, whether from samples
+  for (unsigned int i = 0; i < samplesNum; i++) {
+    all.push_back(make_pair(samples[i], true));
+  }
+  for (unsigned int i = 0; i < baselineNum; i++) {
+    all.push_back(make_pair(baseline[i], false));
+  }
+  sort(all.begin(), all.end());
+  // Rank sum of samples, giving ties their average rank
+  double rankSum = 0, tieSum = 0;
+  for (size_t i = 0, j; i < all.size(); i = j) {
+    for (j = i; j < all.size() && all[j].first == all[i].first; j++) {
+    }
+    double rank = (i + j + 1) / 2.0, ties = double(j - i);
+    for (size_t k = i; k < j; k++) {
+      if (all[k].second) rankSum += rank;
+    }
+    tieSum += ties * ties * ties - ties;
+  }
+  double n1 = samplesNum, n2 = baselineNum, n = n1 + n2;
+  double u = rankSum - n1 * (n1 + 1) / 2;
+  double variance = n1 * n2 / 12 * ((n + 1) - tieSum / (n * (n - 1)));
+  if (variance <= 0) return 1;
+  double z = (u - n1 * n2 / 2 - 0.5) / sqrt(variance);  // Continuity fixed
+  return erfc(z / sqrt(2.0)) / 2;
+}
+
+// Samples of benchmarks in the baseline file, keyed by test path
+// Format of each line: path, then samples, separated by spaces
+// Only BENCHes are saved, while TIMER & AVG_TIMER of the core record nothing
+LIGHTEST_EXTERN map<string, vector<double>> benchBaseline;
+
+// Load the baseline file when it's set, before any benchmark runs, or exit if
+// it can't be read, for a missing baseline mustn't pass the comparison silently
+inline void SetBenchBaseline(const string& fileName) {
+  ifstream file(fileName);
+  if (!file.is_open()) {
+    cerr << "lightest: cannot read baseline " << fileName << endl;
+    exit(1);
+  }
+  benchBaselineFile = fileName;
+  benchBaseline.clear();
+  for (string line; getline(file, line);) {
+    istringstream fields(line);
+    string path;
+    fields >> path;
+    vector<double>& samples = benchBaseline[path];
+    for (double sample; fields >> sample;) samples.push_back(sample);
+  }
+}
+
+// Compare a benchmark with its baseline, and add a regression if it regresses
+inline void CompareWithBaseline(Testing& testing, const DataBench* bench) {
+  if (benchBaselineFile.empty()) return;
+  map<string, vector<double>>::const_iterator baseline =
+      benchBaseline.find(testing.GetPath());
+  if (baseline == benchBaseline.end() || baseline->second.empty()) return;
+  vector<double> sorted(baseline->second);
+  sort(sorted.begin(), sorted.end());
+  double baselineMedian = sorted.size() % 2
+                              ? sorted[sorted.size() / 2]
+                              : (sorted[sorted.size() / 2 - 1] +
+                                 sorted[sorted.size() / 2]) / 2;
+  if (bench->GetMedian() <= baselineMedian * (1 + regressionThreshold)) return;
+  double p = MannWhitneyP(bench->GetSamples(), bench->GetSamplesNum(),
+                          sorted.data(), (unsigned int)sorted.size());
+  if (p >= regressionAlpha) return;
+  testing.AddData(new DataBenchRegression(bench->GetFileName(),
+                                          bench->GetLine(), baselineMedian,
+                                          bench->GetMedian(), p));
+}
+
+// Write samples of all the benchmarks to the baseline file
+inline void SaveBenchBaseline(ostream& file, const DataSet* data,
+                              const string& path) {
+  data->IterSons([&file, &path](const Data* item) {
+    if (item->Type() == DATA_BENCH) {
+      const DataBench* bench = static_cast<const DataBench*>(item);
+      file << path;
+      for (unsigned int i = 0; i < bench->GetSamplesNum(); i++) {
+        file << " " << bench->GetSamples()[i];
+      }
+      file << "\n";
+    } else if (item->Type() == DATA_SET) {
+      const DataSet* son = static_cast<const DataSet*>(item);
+      SaveBenchBaseline(file, son,
+                        path.empty() ? string(son->GetName())
+                                     : path + "/" + son->GetName());
+    }
+  });
+}
+
+// Save the baseline file after running all the tests
+class BenchBaselineSaver : public Listener {
+ public:
+  void OnRunEnd(const DataSet* data) {
+    ofstream file(saveBenchBaselineFile);
+    file.precision(10);
+    SaveBenchBaseline(file, data, "");
+  }
+};
+LIGHTEST_EXTERN BenchBaselineSaver benchBaselineSaver;
+
+inline void SetSaveBenchBaseline(const string& file) {
+  if (saveBenchBaselineFile.empty()) AddListener(&benchBaselineSaver);
+  saveBenchBaselineFile = file;
+  keepTree = true;
+}
+
+// Commandline flags for ARG_CONFIG()
+// Parse a ratio given by a flag, e.g. --regression-threshold 0.1, or exit if
+// it isn't a non-negative number
+inline double ParseRatio(const char* name, const char* value) {
+  char* end = nullptr;
+  errno = 0;
+  double ratio = strtod(value, &end);
+  if (end == value || *end != '\0' || errno == ERANGE || !(ratio >= 0) ||
+      std::isinf(ratio)) {
+    cerr << "lightest: invalid " << name << " '" << value << "'" << endl;
+    exit(1);
+  }
+  return ratio;
+}
+
+inline void MatchBenchFlag(const string& flag, const char* value) {
+  if (flag == "--baseline") SetBenchBaseline(value);
+  if (flag == "--save-baseline") SetSaveBenchBaseline(value);
+  if (flag == "--regression-threshold")
+    regressionThreshold = ParseRatio(flag.c_str(), value);
+}
+LIGHTEST_EXTERN FlagRegistering benchFlags LIGHTEST_INIT(
+    ("--baseline= --save-baseline= --regression-threshold=", MatchBenchFlag));
+
+/* ========== Running ========== */
+
+// Run a benchmark: warm up, pick iterations per sample to reach the target
+// time, and then take samples
+template <typename Func>
+void RunBench(Testing& testing, const char* file, unsigned int line,
+              Func func) {
+  // Warm up with doubling batches, and estimate time per iteration by the
+  // last batch, which is long enough to hide the cost of reading time
+  const long long warmupStart = WallNow(),
+                  warmupEnd = warmupStart + (long long)(benchWarmupTime * 1e6);
+  unsigned long long batch = 1;
+  double iterationNs;
+  while (true) {
+    long long start = WallNow();
+    for (unsigned long long j = 0; j < batch; j++) func();
+    long long now = WallNow();
+    iterationNs = max(double(now - start) / batch, 1e-3);
+    if (now >= warmupEnd) break;
+    if ((now - start) * 2 < warmupEnd - now) batch *= 2;
+  }
+  // Slow functions get fewer samples, but at least a few ones
+  // BENCH_SAMPLES(0) still takes one, or there are no statistics
+  double targetNs = benchTargetTime * 1e6;
+  const unsigned int maxSamplesNum = max(1u, benchSamplesNum);
+  unsigned int samplesNum = maxSamplesNum;
+  if (iterationNs * samplesNum > targetNs) {
+    samplesNum = max(5u, (unsigned int)(targetNs / iterationNs));
+    samplesNum = min(samplesNum, maxSamplesNum);
+  }
+  unsigned long long iterations =
+      max(1ull, (unsigned long long)(targetNs / samplesNum / iterationNs));
+  double* samples = static_cast<double*>(
+      ThreadArena().Allocate(sizeof(double) * samplesNum));
+  for (unsigned int i = 0; i < samplesNum; i++) {
+    long long start = WallNow();
+    for (unsigned long long j = 0; j < iterations; j++) func();
+    samples[i] = double(WallNow() - start) / iterations;
+  }
+  DataBench* bench = new DataBench(file, line, samples, samplesNum, iterations);
+  testing.AddData(bench);
+  CompareWithBaseline(testing, bench);
+}
+
+};  // namespace lightest
+
+/* ========== Registering Macros ========== */
+
+// To define a benchmark, registered and run like a TEST
+// The body is one iteration, so do the preparations outside (e.g. statics)
+// It runs by RunTest like a TEST, so it runs on any job running tests, where
+// other tests running meanwhile disturb its timing
+#define BENCH(name)                                                        \
+  void name();                                                             \
+  void bench_##name(lightest::Testing& testing) {                          \
+    lightest::RunBench(testing, TEST_FILE_NAME, __LINE__, name);           \
+  }                                                                        \
+  void call_##name(lightest::RegisterContext& ctx) {                       \
+    lightest::RunTest(ctx, #name, TEST_FILE_NAME, __LINE__, bench_##name); \
+  }                                                                        \
+  lightest::Registering registering_##name(lightest::testList,             \
+                                           #name, call_##name);            \
+  void name()
+
+/* ========== Configuration Macros ========== */
+
+#define BENCH_TARGET_TIME(ms) lightest::benchTargetTime = (ms);
+#define BENCH_WARMUP_TIME(ms) lightest::benchWarmupTime = (ms);
+#define BENCH_SAMPLES(n) lightest::benchSamplesNum = (n);
+#define BENCH_BASELINE(file) lightest::SetBenchBaseline(file);
+#define SAVE_BENCH_BASELINE(file) lightest::SetSaveBenchBaseline(file);
+#define REGRESSION_THRESHOLD(ratio) lightest::regressionThreshold = (ratio);
+#define REGRESSION_ALPHA(alpha) lightest::regressionAlpha = (alpha);
+
+#endif
@@ -6,89 +6,308 @@ data.
 #ifndef _DATA_ANALYSIS_H_
 #define _DATA_ANALYSIS_H_
 
+#include <algorithm>
+#include <cmath>
 #include "lightest.h"
 
 namespace lightest {
 
 /* ========== Iterating Functions ========== */
 
+// Depth-first iterator over all the tests (recursively including sub tests)
+// under a DataSet, in the order of outputs. It keeps the current node of
+// every level in a stack instead of recursing, so deeply nested SUBs are fine
+// and no allocation is needed per node
+// With failedOnly, only failed tests are visited, and sons of passing ones
+// are skipped, for they can't fail
+class TestIterator {
+ public:
+  TestIterator() : failedOnly(false) {}  // The end
+  TestIterator(const DataSet* data, bool failedOnly_)
+      : failedOnly(failedOnly_) {
+    stack.reserve(8);
+    stack.push_back(data->GetFirstSon());
+    Settle();
+  }
+  const DataSet* operator*() const {
+    return static_cast<const DataSet*>(stack.back());
+  }
+  TestIterator& operator++() {
+    const Data* sub = (**this)->GetFirstSon();
+    if (sub != nullptr) {
+      stack.push_back(sub);
+    } else {
+      stack.back() = stack.back()->GetNext();
+    }
+    Settle();
+    return *this;
+  }
+  bool operator==(const TestIterator& other) const {
+    return stack.empty() ? other.stack.empty()
+                         : !other.stack.empty() &&
+                               stack.back() == other.stack.back();
+  }
+  bool operator!=(const TestIterator& other) const { return !(*this == other); }
+  // Names of the current test and its parents, e.g. "Test/Sub"
+  string GetPath() const {
+    string path;
+    for (const Data* item : stack) {
+      if (!path.empty()) path += '/';
+      path += static_cast<const DataSet*>(item)->GetName();
+    }
+    return path;
+  }
+
+ private:
+  // Move to the next test from the current node, or the end
+  void Settle() {
+    while (!stack.empty()) {
+      const Data* item = stack.back();
+      if (item == nullptr) {  // Sons of a level are done, back to its parent
+        stack.pop_back();
+        if (!stack.empty()) stack.back() = stack.back()->GetNext();
+      } else if (item->Type() == DATA_SET &&
+                 (!failedOnly || item->GetFailed())) {
+        return;
+      } else {
+        stack.back() = item->GetNext();
+      }
+    }
+  }
+  vector<const Data*> stack;
+  bool failedOnly;
+};
+
+// For range-based for, e.g. for (const DataSet* test : AllTests(data))
+class TestRange {
+ public:
+  TestRange(const DataSet* data_, bool failedOnly_)
+      : data(data_), failedOnly(failedOnly_) {}
+  TestIterator begin() const { return TestIterator(data, failedOnly); }
+  TestIterator end() const { return TestIterator(); }
+
+ private:
+  const DataSet* data;
+  bool failedOnly;
+};
+
+// All the tests (recursively including sub tests)
+inline TestRange AllTests(const DataSet* data) {
+  return TestRange(data, false);
+}
+// All the failed tests (recursively including sub tests)
+inline TestRange FailedTests(const DataSet* data) {
+  return TestRange(data, true);
+}
+
 // Iterate all the tests (recursively including sub tests)
-void IterAllTests(const DataSet* data, function<void(const DataSet*)> func) {
-  std::function<void(const lightest::Data*)> iterFunc =
-      [&iterFunc, &func](const lightest::Data* item) {
-        if (item->Type() == lightest::DATA_SET) {
-          func(static_cast<const DataSet*>(item));
-          static_cast<const lightest::DataSet*>(item)->IterSons(iterFunc);
-        }
-      };
-  data->IterSons(iterFunc);
+template <typename Func>
+void IterAllTests(const DataSet* data, Func func) {
+  for (const DataSet* test : AllTests(data)) func(test);
 }
 
 // Iterate all the failed tests (recursively including sub tests)
-void IterFailedTests(const DataSet* data, function<void(const DataSet*)> func) {
-  std::function<void(const lightest::Data*)> iterFunc =
-      [&iterFunc, &func](const lightest::Data* item) {
-        if (item->Type() == lightest::DATA_SET && item->GetFailed()) {
-          func(static_cast<const DataSet*>(item));
-          static_cast<const lightest::DataSet*>(item)->IterSons(iterFunc);
-        }
-      };
-  data->IterSons(iterFunc);
+template <typename Func>
+void IterFailedTests(const DataSet* data, Func func) {
+  for (const DataSet* test : FailedTests(data)) func(test);
+}
+
+// Count REQs of all the tests, including passing ones not recorded
+inline void CountReqs(const DataSet* data, unsigned int& reqsNum,
+                      unsigned int& failedReqsNum) {
+  reqsNum += data->GetAllReqsNum();
+  failedReqsNum += data->GetAllFailedReqsNum();
+}
+
+// Percentage of passed ones in total, 100 for none, e.g. when no TEST runs
+inline double PassRate(unsigned int failedNum, unsigned int totalNum) {
+  return totalNum == 0 ? 100 : (1 - double(failedNum) / totalNum) * 100;
+}
+
+// Average of a sum over num items, 0 for none
+inline double Average(double sum, unsigned int num) {
+  return num == 0 ? 0 : sum / num;
 }
 
+/* ========== Durations ========== */
+
+typedef struct {
+  double duration;  // ms
+  string path;
+} TestDuration;
+
+// Durations (ms) of all the tests (recursively including sub tests), taken in
+// one pass: the slowest ones by a bounded heap, and the rest counted in
+// log-scaled buckets for percentiles
+class DurationStats {
+ public:
+  DurationStats(const DataSet* data, size_t slowestNum)
+      : testsNum(0), maxDuration(0), buckets() {
+    // Min-heap of the slowest tests so far, the fastest of them on top
+    auto slower = [](const TestDuration& a, const TestDuration& b) {
+      return a.duration > b.duration;
+    };
+    slowest.reserve(slowestNum + 1);
+    const TestRange tests = AllTests(data);
+    for (TestIterator it = tests.begin(); it != tests.end(); ++it) {
+      const double duration = (*it)->GetDuration();
+      buckets[BucketOf(duration)]++;
+      testsNum++;
+      maxDuration = max(maxDuration, duration);
+      if (slowest.size() == slowestNum &&
+          (slowestNum == 0 || duration <= slowest.front().duration)) {
+        continue;  // Paths are only made for tests kept
+      }
+      slowest.push_back(TestDuration{duration, it.GetPath()});
+      push_heap(slowest.begin(), slowest.end(), slower);
+      if (slowest.size() > slowestNum) {
+        pop_heap(slowest.begin(), slowest.end(), slower);
+        slowest.pop_back();
+      }
+    }
+    sort_heap(slowest.begin(), slowest.end(), slower);  // Slowest first
+  }
+  // The slowest tests, slowest first
+  const vector<TestDuration>& GetSlowest() const { return slowest; }
+  unsigned int GetTestsNum() const { return testsNum; }
+  double GetMaxDuration() const { return maxDuration; }
+  // Duration (ms) under which the given ratio of tests end, e.g. 0.9 for
+  // p90, as the upper bound of its bucket (at most 25% over the real one)
+  double GetPercentile(double ratio) const {
+    unsigned int rank = (unsigned int)ceil(ratio * testsNum), count = 0;
+    for (int i = 0; i < bucketsNum; i++) {
+      count += buckets[i];
+      if (count >= rank && count > 0) return min(UpperOf(i), maxDuration);
+    }
+    return maxDuration;
+  }
+  // Print non-empty buckets with bars, the longest being width characters
+  void PrintHistogram(unsigned int width = 30) const {
+    unsigned int most = *max_element(buckets, buckets + bucketsNum);
+    for (int i = 0; i < bucketsNum; i++) {
+      if (buckets[i] == 0) continue;
+      Output() << "  < " << UpperOf(i) << " ms  "
+               << string(buckets[i] * width / most, '#') << " " << buckets[i]
+               << '\n';
+    }
+  }
+
+ private:
+  // Bucket 0 for 0 ms, and then subBuckets buckets per power of 2 from
+  // 2^minExp ms (~1 ns)
+  static const int subBuckets = 4, minExp = -20, maxExp = 44;
+  static const int bucketsNum = (maxExp - minExp) * subBuckets + 1;
+  static int BucketOf(double duration) {
+    if (duration <= 0) return 0;
+    int exp;
+    double mantissa = frexp(duration, &exp);  // In [0.5, 1)
+    if (exp <= minExp) return 1;
+    if (exp > maxExp) return bucketsNum - 1;
+    return (exp - minExp - 1) * subBuckets +
+           int((mantissa * 2 - 1) * subBuckets) + 1;
+  }
+  static double UpperOf(int bucket) {
+    if (bucket == 0) return 0;
+    int exp = (bucket - 1) / subBuckets + minExp + 1;
+    int sub = (bucket - 1) % subBuckets;
+    return ldexp(0.5 + 0.5 * (sub + 1) / subBuckets, exp);
+  }
+  vector<TestDuration> slowest;
+  unsigned int testsNum;
+  double maxDuration;
+  unsigned int buckets[bucketsNum];
+};
+
 /* ========== Reporting Macros ========== */
 
 // Wrap box for reporting macros
-#define REPORT()                                                \
-  void ReportWrapFunc(const lightest::DataSet* data);           \
-  DATA(Report) {                                                \
-    std::cout << "──────────────────────────────" << std::endl  \
-              << "# Final report:" << std::endl;                \
-    ReportWrapFunc(data);                                       \
-    std::cout << "──────────────────────────────" << std::endl; \
-  }                                                             \
-  void ReportWrapFunc(const lightest::DataSet* data)
+#define REPORT()                                              \
+  void ReportWrapFunc(const lightest::DataSet* data);         \
+  DATA(Report) {                                              \
+    lightest::Output() << "──────────────────────────────\n"  \
+                       << "# Final report:\n";                \
+    ReportWrapFunc(data);                                     \
+    lightest::Output() << "──────────────────────────────\n"; \
+  }                                                           \
+  void ReportWrapFunc(const lightest::DataSet* data _MAYBE_UNUSED_)
 
 // List all the failed tests (recursively including sub tests)
 #define REPORT_FAILED_TESTS()                                 \
   do {                                                        \
-    std::cout << "Failed tests:" << std::endl;                \
+    lightest::Output() << "Failed tests:\n";                  \
     IterFailedTests(data, [](const lightest::DataSet* item) { \
       item->PrintTabs();                                      \
-      std::cout << " * " << item->GetName() << std::endl;     \
+      lightest::Output() << " * " << item->GetName() << '\n'; \
     });                                                       \
   } while (0)
 
 // Calculate passing rate and also report the numbers of failed, passed, and
 // total tests (just include global tests)
-#define REPORT_PASS_RATE()                                                   \
-  do {                                                                       \
-    unsigned int failedTestCount = 0;                                        \
-    data->IterSons([&failedTestCount](const lightest::Data* item) {          \
-      if (item->GetFailed()) failedTestCount++;                              \
-    });                                                                      \
-    std::cout << "Pass rate: "                                               \
-              << (1 - double(failedTestCount) / data->GetSonsNum()) * 100    \
-              << "% ";                                                       \
-    PRINT_LABEL(lightest::Color::Red, " " << failedTestCount << " failed "); \
-    PRINT_LABEL(lightest::Color::Green,                                      \
-                " " << data->GetSonsNum() - failedTestCount << " passed ");  \
-    PRINT_LABEL(lightest::Color::Blue,                                       \
-                " " << data->GetSonsNum() << " total ");                     \
-    lightest::SetColor(lightest::Color::Reset);                              \
-    std::cout << std::endl;                                                  \
+#define REPORT_PASS_RATE()                                                    \
+  do {                                                                        \
+    unsigned int failedTestCount = data->GetFailedSubsNum();                  \
+    lightest::Output() << "Pass rate: "                                       \
+                       << lightest::PassRate(failedTestCount,                 \
+                                             data->GetSubsNum())              \
+                       << "% ";                                               \
+    PRINT_LABEL(lightest::Color::Red, " " << failedTestCount << " failed ");  \
+    PRINT_LABEL(lightest::Color::Green,                                       \
+                " " << data->GetSubsNum() - failedTestCount << " passed ");   \
+    PRINT_LABEL(lightest::Color::Blue,                                        \
+                " " << data->GetSubsNum() << " total ");                      \
+    lightest::SetColor(lightest::Color::Reset);                               \
+    lightest::Output() << '\n';                                               \
+  } while (0)
+
+// Calculate passing rate and also report the numbers of failed, passed, and
+// total REQs (recursively including sub tests)
+#define REPORT_REQ_PASS_RATE()                                                \
+  do {                                                                        \
+    unsigned int reqsNum = 0, failedReqsNum = 0;                              \
+    lightest::CountReqs(data, reqsNum, failedReqsNum);                        \
+    lightest::Output() << "REQ pass rate: "                                   \
+                       << lightest::PassRate(failedReqsNum, reqsNum) << "% "; \
+    PRINT_LABEL(lightest::Color::Red, " " << failedReqsNum << " failed ");    \
+    PRINT_LABEL(lightest::Color::Green,                                       \
+                " " << reqsNum - failedReqsNum << " passed ");                \
+    PRINT_LABEL(lightest::Color::Blue, " " << reqsNum << " total ");          \
+    lightest::SetColor(lightest::Color::Reset);                               \
+    lightest::Output() << '\n';                                               \
+  } while (0)
+
+// Calculate & report the average wall time and CPU time of global tests
+#define REPORT_AVG_TIME()                                               \
+  do {                                                                  \
+    lightest::Output() << "Average time: "                              \
+                       << lightest::Average(data->GetSubsDuration(),    \
+                                            data->GetSubsNum())         \
+                       << " ms, CPU time: "                             \
+                       << lightest::Average(data->GetSubsCpuDuration(), \
+                                            data->GetSubsNum())         \
+                       << " ms\n";                                      \
+  } while (0)
+
+// List the n slowest tests (recursively including sub tests) by wall time
+#define REPORT_SLOWEST(n)                                              \
+  do {                                                                 \
+    lightest::DurationStats stats(data, n);                            \
+    lightest::Output() << "Slowest tests:\n";                          \
+    for (const lightest::TestDuration& item : stats.GetSlowest()) {    \
+      lightest::Output() << " * " << item.path << " " << item.duration \
+                         << " ms\n";                                   \
+    }                                                                  \
   } while (0)
 
-// Calculate & report the average time of global tests
-#define REPORT_AVG_TIME()                                                    \
-  do {                                                                       \
-    clock_t timeSum = 0;                                                     \
-    data->IterSons([&timeSum](const lightest::Data* item) {                  \
-      timeSum += static_cast<const lightest::DataSet*>(item)->GetDuration(); \
-    });                                                                      \
-    std::cout << "Average time: "                                            \
-              << lightest::TimeToMs(timeSum) / data->GetSonsNum() << " ms"   \
-              << std::endl;                                                  \
+// Report percentiles and a histogram of wall time of all the tests
+// (recursively including sub tests)
+#define REPORT_DURATIONS()                                                  \
+  do {                                                                      \
+    lightest::DurationStats stats(data, 0);                                 \
+    lightest::Output() << "Durations: p50 " << stats.GetPercentile(0.5)     \
+                       << " ms, p90 " << stats.GetPercentile(0.9)           \
+                       << " ms, p99 " << stats.GetPercentile(0.99)          \
+                       << " ms, max " << stats.GetMaxDuration() << " ms\n"; \
+    stats.PrintHistogram();                                                 \
   } while (0)
 
 };  // namespace lightest
@@ -0,0 +1,441 @@
+/*
+This is a Lightest extension, which runs tests in a pool of forked worker
+processes, so that a test crashing (e.g. by SIGSEGV) only costs a restart of
+its worker instead of the whole run. Workers send results back through pipes,
+and crashes are recorded as DataCrash. Only available on Linux & macOS, while
+tests are run as usual on other platforms.
+*/
+
+#ifndef _ISOLATION_EXT_H_
+#define _ISOLATION_EXT_H_
+
+#include <cstdint>
+#include "lightest.h"
+#include "parallel_ext.h"
+#include "timeout_ext.h"
+
+#if defined(__linux__) || defined(__APPLE__)
+#define _ISOLATION_
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace lightest {
+
+// Data class of a test whose worker process crashed or exited
+class DataCrash : public Data {
+ public:
+  DataCrash(int signal_, int exitCode_)
+      : signal(signal_), exitCode(exitCode_) {}
+  void Print() const {
+    PrintTabs();
+    PRINT_LABEL(Color::Red, " CRASH ");
+    if (signal != 0) {
+#ifdef _ISOLATION_
+      Output() << " Killed by signal " << signal << " (" << strsignal(signal)
+               << ")\n";
+#endif
+    } else {
+      Output() << " Exited with code " << exitCode << "\n";
+    }
+  }
+  DataType Type() const { return DATA_CRASH; }
+  const bool GetFailed() const { return true; }
+  // 0 if the worker wasn't killed by a signal
+  int GetSignal() const { return signal; }
+  int GetExitCode() const { return exitCode; }
+  Failure GetFailure() const {
+    string message = "Exited with code " + to_string(exitCode);
+    if (signal != 0) {
+      message = "Killed by signal " + to_string(signal);
+#ifdef _ISOLATION_
+      message += string(" (") + strsignal(signal) + ")";
+#endif
+    }
+    return Failure{"CRASH", message, nullptr, 0};
+  }
+
+ private:
+  int signal, exitCode;
+};
+
+/* ========== Worker Pool ========== */
+
+#ifdef _ISOLATION_
+
+// Read or write exactly size bytes, false on failure or EOF
+inline bool ReadAll(int fd, void* buffer, size_t size) {
+  char* pos = static_cast<char*>(buffer);
+  while (size > 0) {
+    ssize_t got = read(fd, pos, size);
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0) return false;
+    pos += got, size -= size_t(got);
+  }
+  return true;
+}
+inline bool WriteAll(int fd, const void* buffer, size_t size) {
+  const char* pos = static_cast<const char*>(buffer);
+  while (size > 0) {
+    ssize_t put = write(fd, pos, size);
+    if (put < 0 && errno == EINTR) continue;
+    if (put <= 0) return false;
+    pos += put, size -= size_t(put);
+  }
+  return true;
+}
+
+// Header of each message through a result pipe, kept apart from the size so
+// that any size can be sent
+typedef struct {
+  uint64_t size;  // Of the bytes following
+  unsigned int flags;
+} ResultHeader;
+// Marks results sent by a worker whose test timed out
+const unsigned int timedOutFlag = 1u << 0;
+// Marks a deadline (ms from now) set by the running test, instead of results
+const unsigned int deadlineFlag = 1u << 1;
+// Time (ms) a worker gets past the latest deadline of its test to report the
+// timeout itself, before the parent kills it
+const long long workerKillGrace = 1000;
+
+// Send data in a DataSet through a pipe, prefixed by its size and flags
+inline bool SendData(int fd, const DataSet* collector, unsigned int flags) {
+  Encoder encoder;
+  collector->IterSons([&encoder](const Data* son) {
+    if (CanEncode(son)) EncodeData(son, encoder);
+  });
+  encoder.Put<unsigned char>(dataSetEnd);
+  ResultHeader header = ResultHeader();
+  header.size = encoder.bytes.size(), header.flags = flags;
+  return WriteAll(fd, &header, sizeof(header)) &&
+         WriteAll(fd, encoder.bytes.data(), encoder.bytes.size());
+}
+
+// Result pipe of the current worker process, written under the lock, for
+// deadlines and timeouts are sent from the threads setting and watching them
+LIGHTEST_EXTERN int workerResultFd LIGHTEST_INIT(= -1);
+LIGHTEST_EXTERN mutex workerResultLock;
+
+// Timeout handler of workers, which reports the timed out test, and then
+// waits to be killed by the parent
+inline void WorkerTimedOut(Testing& testing, unsigned int limit) {
+  FlushOutput();
+  DataSet collector("");
+  collector.SetTabs(0);
+  collector.Add(TimedOutData(testing, limit));
+  {
+    lock_guard<mutex> guard(workerResultLock);
+    SendData(workerResultFd, &collector, timedOutFlag);
+  }
+  while (true) pause();
+}
+
+// Deadline hook of workers, which also sends the deadline to the parent, so
+// that the parent can kill the worker if the timeout is never reported, e.g.
+// when the watchdog thread can't run
+inline void WorkerWatchTest(Testing* testing, unsigned int limit) {
+  WatchTest(testing, limit);
+  ResultHeader header = ResultHeader();
+  header.size = sizeof(limit), header.flags = deadlineFlag;
+  lock_guard<mutex> guard(workerResultLock);
+  if (WriteAll(workerResultFd, &header, sizeof(header))) {
+    WriteAll(workerResultFd, &limit, sizeof(limit));
+  }
+}
+
+// Worker processes forked before running any test
+// A worker reads indexes of tests to run from its task pipe, and replies the
+// encoded data of each test through its result pipe
+class WorkerPool {
+ public:
+  WorkerPool(const Register& reg_, unsigned int workersNum) : reg(reg_) {
+    // Writing to a crashed worker mustn't kill us, while tests in workers and
+    // code after the pool get the handler of users back
+    struct sigaction ignore;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGPIPE, &ignore, &userSigpipe);
+    workers.resize(workersNum, Worker{-1, -1, -1, -1, 0, 0, 0});
+    for (Worker& worker : workers) Spawn(worker);
+  }
+  // Run all the tests, and collect their data in registration order
+  // Workers failing to start (e.g. fork() failing with EAGAIN) are retried
+  // when there are tests to run. Without any worker, the rest of the tests
+  // are recorded as failed, keeping the data collected so far
+  // A worker running past the latest deadline of its test and the grace is
+  // killed, and the test is recorded as timed out
+  void RunAll(DataSet* testData) {
+    vector<DataSet*> collectors(reg.GetRegisteredNum(), nullptr);
+    size_t nextTest = 0, finishedNum = 0;
+    vector<pollfd> fds(workers.size());
+    while (finishedNum < collectors.size()) {
+      size_t runningNum = 0;
+      for (Worker& worker : workers) {
+        if (worker.test != -1) {
+          runningNum++;
+          continue;
+        }
+        if (nextTest == collectors.size()) continue;
+        if (worker.pid == -1 && !Spawn(worker)) continue;
+        unsigned int index = (unsigned int)nextTest;
+        if (!WriteAll(worker.taskFd, &index, sizeof(index))) {
+          Restart(worker);  // Died when idle, retry on a new one
+          continue;
+        }
+        worker.test = (long long)nextTest++;
+        worker.start = WallNow();
+        worker.deadline = 0;
+        runningNum++;
+      }
+      if (runningNum == 0) {
+        for (; nextTest < collectors.size(); nextTest++, finishedNum++) {
+          collectors[nextTest] = NotRun(nextTest);
+          collectors[nextTest]->IterSons([](const Data* item) {
+            NotifyTestData(static_cast<const DataSet*>(item));
+          });
+        }
+        break;
+      }
+      long long nextKill = LLONG_MAX;
+      for (size_t i = 0; i < workers.size(); i++) {
+        fds[i].fd = workers[i].test == -1 ? -1 : workers[i].resultFd;
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+        if (workers[i].test != -1 && workers[i].deadline != 0) {
+          nextKill = min(nextKill, KillTime(workers[i]));
+        }
+      }
+      int wait = -1;
+      if (nextKill != LLONG_MAX) {
+        wait = (int)min(max((nextKill - WallNow()) / 1000000 + 1, 0LL),
+                        (long long)INT_MAX);
+      }
+      if (poll(fds.data(), nfds_t(fds.size()), wait) < 0) continue;
+      long long now = WallNow();
+      for (size_t i = 0; i < workers.size(); i++) {
+        Worker& worker = workers[i];
+        if (worker.test == -1) continue;
+        DataSet*& collector = collectors[size_t(worker.test)];
+        bool timedOut = false;
+        if (fds[i].revents == 0) {
+          if (worker.deadline == 0 || now < KillTime(worker)) continue;
+          collector = Killed(worker);
+          Restart(worker);
+        } else if (!Receive(worker, collector, timedOut)) {
+          collector = Crashed(worker);
+          Restart(worker);
+        } else if (collector == nullptr) {
+          continue;  // Only a deadline
+        } else if (timedOut) {
+          kill(worker.pid, SIGKILL);
+          Restart(worker);
+        }
+        collector->IterSons([](const Data* item) {
+          NotifyTestData(static_cast<const DataSet*>(item));
+        });
+        worker.test = -1;
+        finishedNum++;
+      }
+    }
+    for (DataSet* collector : collectors) {
+      collector->MoveSons(testData);
+      delete collector;
+    }
+  }
+  ~WorkerPool() {
+    for (Worker& worker : workers) Stop(worker);
+    sigaction(SIGPIPE, &userSigpipe, nullptr);
+  }
+
+ private:
+  typedef struct {
+    pid_t pid;
+    int taskFd, resultFd;
+    long long test;      // Index of the running test, -1 when idle
+    long long start;     // When the running test was sent
+    long long deadline;  // Latest deadline of the running test, 0 for none
+    unsigned int limit;  // Time limit (ms) giving the deadline
+  } Worker;
+  long long KillTime(const Worker& worker) const {
+    return worker.deadline + workerKillGrace * 1000000;
+  }
+  // Start a worker process, false if it fails, leaving the worker stopped
+  bool Spawn(Worker& worker) {
+    int taskPipe[2], resultPipe[2];
+    if (pipe(taskPipe) != 0) return SpawnFailed("pipe", {});
+    if (pipe(resultPipe) != 0) {
+      return SpawnFailed("pipe", {taskPipe[0], taskPipe[1]});
+    }
+    FlushOutput();  // Or the worker inherits and writes the buffered outputs
+    pid_t pid = fork();
+    if (pid < 0) {
+      return SpawnFailed(
+          "fork", {taskPipe[0], taskPipe[1], resultPipe[0], resultPipe[1]});
+    }
+    if (pid == 0) {
+      sigaction(SIGPIPE, &userSigpipe, nullptr);
+      close(taskPipe[1]);
+      close(resultPipe[0]);
+      // Close pipes to other workers, or they never read EOF when stopped
+      for (Worker& other : workers) {
+        if (other.pid == -1) continue;
+        close(other.taskFd);
+        close(other.resultFd);
+      }
+      Work(taskPipe[0], resultPipe[1]);
+    }
+    close(taskPipe[0]);
+    close(resultPipe[1]);
+    worker = Worker{pid, taskPipe[1], resultPipe[0], -1, 0, 0, 0};
+    return true;
+  }
+  // Report the failing call of Spawn(), and close the pipes it opened
+  bool SpawnFailed(const char* call, const vector<int>& fds) {
+    spawnError = string(call) + ": " + strerror(errno);
+    cerr << "lightest: " << spawnError << endl;
+    for (int fd : fds) close(fd);
+    return false;
+  }
+  // Loop of a worker process, which never returns
+  void Work(int taskFd, int resultFd) {
+    workerResultFd = resultFd;
+    timeoutHandler = WorkerTimedOut;
+    watchTest = WorkerWatchTest;
+    unsigned int index;
+    while (ReadAll(taskFd, &index, sizeof(index))) {
+      DataSet collector("");
+      collector.SetTabs(0);
+      reg.RunOne(index, &collector);
+      FlushOutput();  // Outputs of the test go before its result is received
+      lock_guard<mutex> guard(workerResultLock);
+      if (!SendData(resultFd, &collector, 0)) break;
+    }
+    _exit(0);  // Skip destructors & atexit handlers of the parent's state
+  }
+  // Receive the results of the test, or only a deadline of it, leaving the
+  // collector as it is
+  bool Receive(Worker& worker, DataSet*& collector, bool& timedOut) {
+    ResultHeader header;
+    if (!ReadAll(worker.resultFd, &header, sizeof(header))) return false;
+    if (header.flags & deadlineFlag) {
+      unsigned int limit;
+      if (!ReadAll(worker.resultFd, &limit, sizeof(limit))) return false;
+      long long deadline = WallNow() + (long long)limit * 1000000;
+      if (deadline > worker.deadline) worker.deadline = deadline;
+      worker.limit = limit;
+      return true;
+    }
+    timedOut = (header.flags & timedOutFlag) != 0;
+    string bytes(size_t(header.size), '\0');
+    if (!ReadAll(worker.resultFd, &bytes[0], bytes.size())) return false;
+    Decoder decoder(bytes.data());
+    collector = new DataSet("");
+    collector->SetTabs(0);
+    while (Data* son = DecodeData(decoder)) collector->Add(son);
+    return true;
+  }
+  // Record the crash of the worker as data of its test
+  DataSet* Crashed(Worker& worker) {
+    int status = Reap(worker);
+    return Failed(worker,
+                  new DataCrash(WIFSIGNALED(status) ? WTERMSIG(status) : 0,
+                                WIFEXITED(status) ? WEXITSTATUS(status) : 0));
+  }
+  // Kill the worker whose test never reported its timeout, recording the test
+  // as timed out
+  DataSet* Killed(Worker& worker) {
+    kill(worker.pid, SIGKILL);
+    Reap(worker);
+    const char* name = reg.GetName(size_t(worker.test));
+    return Failed(worker, new DataTimeout(CopyToArena(name), worker.limit));
+  }
+  // Wait for the ended worker, returning its status
+  int Reap(Worker& worker) {
+    int status = 0;
+    close(worker.taskFd);
+    close(worker.resultFd);
+    while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    worker.pid = -1;
+    return status;
+  }
+  // Data of the test of the worker, failed by the data
+  DataSet* Failed(Worker& worker, Data* data) {
+    DataSet* test = new DataSet(reg.GetName(size_t(worker.test)));
+    test->SetTabs(1);
+    test->Add(data);
+    test->End(WallNow() - worker.start, 0);
+    DataSet* collector = new DataSet("");
+    collector->SetTabs(0);
+    collector->Add(test);
+    return collector;
+  }
+  // Record a test as failed, for no worker could be started to run it
+  DataSet* NotRun(size_t index) {
+    DataSet* test = new DataSet(reg.GetName(index));
+    test->SetTabs(1);
+    string message = "No worker process to run the test, " + spawnError;
+    test->Add(new DataUncaughtError("isolation_ext.h", __LINE__,
+                                    CopyToArena(message)));
+    test->End(0, 0);
+    DataSet* collector = new DataSet("");
+    collector->SetTabs(0);
+    collector->Add(test);
+    return collector;
+  }
+  void Restart(Worker& worker) {
+    if (worker.pid != -1) Stop(worker);
+    Spawn(worker);
+  }
+  void Stop(Worker& worker) {
+    if (worker.pid == -1) return;  // Failed to start
+    close(worker.taskFd);  // The worker exits reading EOF
+    close(worker.resultFd);
+    while (waitpid(worker.pid, nullptr, 0) < 0 && errno == EINTR) {
+    }
+    worker.pid = -1;
+  }
+  const Register& reg;
+  vector<Worker> workers;
+  string spawnError;  // Why the last worker failed to start
+  struct sigaction userSigpipe;  // Restored when the pool is destroyed
+};
+
+#endif
+
+// Runner of TESTs in worker processes, as many as jobs
+inline void RunIsolated(Register& reg) {
+#ifdef _ISOLATION_
+  if (reg.GetRegisteredNum() == 0) return;
+  WorkerPool pool(reg, ResolveJobs());
+  pool.RunAll(reg.testData);
+#else
+  reg.RunRegistered();
+#endif
+}
+
+// Commandline flags for ARG_CONFIG(), which is only --isolation
+inline void MatchIsolationFlag(const string&, const char*) {
+#ifdef _ISOLATION_
+  testsRunner = RunIsolated;
+#endif
+}
+LIGHTEST_EXTERN FlagRegistering isolationFlags
+    LIGHTEST_INIT(("--isolation", MatchIsolationFlag));
+
+};  // namespace lightest
+
+// Run TESTs in forked worker processes, as many as PARALLEL(n) sets
+#ifdef _ISOLATION_
+#define ISOLATION() lightest::testsRunner = lightest::RunIsolated;
+#else
+#define ISOLATION()  // Tests are run as usual
+#endif
+
+#undef _ISOLATION_
+
+#endif
@@ -19,26 +19,214 @@ test framework. Licensed under MIT.
 #warning Unknown platform to Lightest will cause no outputing color
 #endif
 
+// Only headers needed by every test file, while running tests on threads,
+// timeouts, sharding and file outputs are in extensions with their headers
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <exception>
-#include <functional>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 // For coloring on Windows
 #ifdef _WIN_
 #include <Windows.h>
+#include <io.h>
 #endif
 
+// For reading time stamp counter on x86, by the builtins of compilers instead
+// of including intrinsic headers, which are huge
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+extern "C" unsigned __int64 __rdtsc();
+#pragma intrinsic(__rdtsc)
+#define _TSC_
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define _TSC_
+#endif
+
+// For writing outputs to file descriptors
+#if defined(_LINUX_) || defined(_MAC_)
+#include <errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#if !defined(_LINUX_) && !defined(_WIN_) && !defined(_MAC_)
+#include <thread>  // For blocking threads forever
+#endif
+
+// Declarations for TESTs, SUBs & REQs, also included alone by slim test files
+#include "lightest_lite.h"
+
+// Keep functions called by lots of expanded macros (e.g. REQ) out of line
+#if defined(_MSC_VER)
+#define _NOINLINE_ __declspec(noinline)
+#elif defined(__GNUC__)
+#define _NOINLINE_ __attribute__((noinline))
+#else
+#define _NOINLINE_
+#endif
+
+// Untility for catching an error and return its detail as type const char*
+#define CATCH(sentence)                         \
+  ([&]() -> const char* {                       \
+    try {                                       \
+      sentence;                                 \
+    } catch (const char* str) {                 \
+      return str;                               \
+    } catch (const std::exception& err) {       \
+      /* Dies with the error, so copy it */     \
+      return lightest::CopyToArena(err.what()); \
+    } catch (...) {                             \
+      return "Unknown type error";              \
+    }                                           \
+    return nullptr;                             \
+  })()
+
 namespace lightest {
 using namespace std;
 
+/* ========== Output Sink ========== */
+
+// A buffered sink for all the outputs of Lightest
+// Outputs are kept in a large buffer, and only written out when it's full or
+// at flush points (after default outputs and around each DATA), instead of
+// being flushed on every line
+class OutputSink : public streambuf {
+ public:
+  OutputSink() : buffer(bufferSize) {
+    setp(buffer.data(), buffer.data() + buffer.size());
+  }
+  void Flush() {
+    if (pptr() == pbase()) return;
+    Write(pbase(), pptr() - pbase(), nullptr, 0);
+    setp(buffer.data(), buffer.data() + buffer.size());
+  }
+  virtual ~OutputSink() {}
+
+ protected:
+  // Write the buffered outputs followed by another piece of outputs
+  virtual void Write(const char* head, size_t headSize, const char* tail,
+                     size_t tailSize) = 0;
+  int_type overflow(int_type ch) {
+    Flush();
+    if (traits_type::eq_int_type(ch, traits_type::eof())) return ch;
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+    return ch;
+  }
+  streamsize xsputn(const char* s, streamsize n) {
+    if (n <= epptr() - pptr()) {
+      memcpy(pptr(), s, size_t(n));
+      pbump(int(n));
+    } else {
+      // Too long to buffer, so write it out together with the buffer
+      Write(pbase(), pptr() - pbase(), s, size_t(n));
+      setp(buffer.data(), buffer.data() + buffer.size());
+    }
+    return n;
+  }
+  int sync() {
+    Flush();
+    return 0;
+  }
+
+ private:
+  static const size_t bufferSize = 1 << 16;
+  vector<char> buffer;
+};
+
+// Sink writing to an ostream, e.g. std::cout or a std::ofstream
+class StreamSink : public OutputSink {
+ public:
+  StreamSink(ostream& os_) : os(os_) {}
+  ~StreamSink() { Flush(); }
+
+ protected:
+  void Write(const char* head, size_t headSize, const char* tail,
+             size_t tailSize) {
+    os.write(head, headSize);
+    if (tailSize > 0) os.write(tail, tailSize);
+    os.flush();
+  }
+
+ private:
+  ostream& os;
+};
+
+// Sink writing to a raw file descriptor, by one writev call a flush on
+// Unix-like systems
+class FdSink : public OutputSink {
+ public:
+  FdSink(int fd_) : fd(fd_) {}
+  ~FdSink() { Flush(); }
+
+ protected:
+  void Write(const char* head, size_t headSize, const char* tail,
+             size_t tailSize) {
+#if defined(_LINUX_) || defined(_MAC_)
+    iovec pieces[2] = {{const_cast<char*>(head), headSize},
+                       {const_cast<char*>(tail), tailSize}};
+    iovec* piece = pieces;
+    int piecesNum = tailSize > 0 ? 2 : 1;
+    while (piecesNum > 0) {
+      ssize_t written = writev(fd, piece, piecesNum);
+      if (written < 0) {
+        if (errno == EINTR) continue;
+        return;  // Nowhere to report the error
+      }
+      // Skip what has been written
+      for (; piecesNum > 0 && size_t(written) >= piece->iov_len; piecesNum--) {
+        written -= piece->iov_len;
+        piece++;
+      }
+      if (piecesNum > 0) {
+        piece->iov_base = static_cast<char*>(piece->iov_base) + written;
+        piece->iov_len -= written;
+      }
+    }
+#elif defined(_WIN_)
+    _write(fd, head, (unsigned int)headSize);
+    if (tailSize > 0) _write(fd, tail, (unsigned int)tailSize);
+#endif
+  }
+
+ private:
+  int fd;
+};
+
+LIGHTEST_EXTERN StreamSink coutSink LIGHTEST_INIT((cout));
+// Use Output() to write outputs
+LIGHTEST_EXTERN ostream output LIGHTEST_INIT((&coutSink));
+
+inline ostream& Output() { return output; }
+// Flush outputs of Lightest, and standard outputs written by users meanwhile
+inline void FlushOutput() {
+  output.flush();
+  cout.flush();
+}
+// Use OUTPUT_TO(os), OUTPUT_TO_FD(fd) or OUTPUT_TO_SINK(sink) to set
+inline void SetOutputSink(OutputSink* sink) {
+  output.flush();
+  output.rdbuf(sink);
+}
+
 /* ========== Output Color ==========*/
 
 enum class Color { Reset = 0, Red = 41, Green = 42, Yellow = 43, Blue = 44 };
-bool outputColor = true;  // Use NO_COLOR() to set false
+// Use NO_COLOR() to set false
+LIGHTEST_EXTERN bool outputColor LIGHTEST_INIT(= true);
 
-void SetColor(Color color) {
+inline void SetColor(Color color) {
 #ifdef _WIN_
   // Set output mode to handle virtual terminal sequences
   HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
@@ -55,16 +243,216 @@ void SetColor(Color color) {
   }
 #endif
   if (outputColor) {
-    cout << "\033[" << int(color) << "m";
+    Output() << "\033[" << int(color) << "m";
+  }
+}
+
+/* ========== Arena ========== */
+
+// A bump allocator for test data
+// Data are allocated in growing chunks, and all released in one shot by
+// Release() without running their destructors
+class Arena {
+ public:
+  Arena() : current(nullptr), left(0), chunkSize(minChunkSize), allocNum(0) {}
+  void* Allocate(size_t size) {
+    // Keep every allocation aligned for any type
+    size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+    if (size > left) NewChunk(size);
+    void* ptr = current;
+    current += size, left -= size;
+    allocNum++;
+    return ptr;
+  }
+  void Release() {
+    for (char* chunk : chunks) {
+      ::operator delete(chunk);
+    }
+    chunks.clear();
+    current = nullptr, left = 0, chunkSize = minChunkSize;
+  }
+  // Position of the arena, to free all the allocations after it by Rewind()
+  typedef struct {
+    size_t chunksNum;
+    char* current;
+    size_t left, chunkSize;
+  } Mark;
+  Mark GetMark() const { return Mark{chunks.size(), current, left, chunkSize}; }
+  void Rewind(const Mark& mark) {
+    for (size_t i = mark.chunksNum; i < chunks.size(); i++) {
+      ::operator delete(chunks[i]);
+    }
+    chunks.resize(mark.chunksNum);
+    current = mark.current, left = mark.left, chunkSize = mark.chunkSize;
+  }
+  // Count of allocations from the arena, and of chunks it holds
+  size_t GetAllocNum() const { return allocNum; }
+  size_t GetChunksNum() const { return chunks.size(); }
+  ~Arena() { Release(); }
+
+ private:
+  void NewChunk(size_t size) {
+    if (chunkSize < maxChunkSize) chunkSize *= 2;
+    size_t newSize = size > chunkSize ? size : chunkSize;
+    current = static_cast<char*>(::operator new(newSize));
+    left = newSize;
+    chunks.push_back(current);
+  }
+  static const size_t minChunkSize = 1 << 11, maxChunkSize = 1 << 20;
+  char* current;
+  size_t left, chunkSize, allocNum;
+  vector<char*> chunks;
+};
+
+// Arenas of all the threads
+// Data allocated on a thread may still be used after the thread ends, so an
+// arena is only handed to a new thread when its owner ends, and all of them
+// are released together at the end of a run
+LIGHTEST_EXTERN vector<Arena*> arenas;
+LIGHTEST_EXTERN vector<Arena*> freeArenas;
+LIGHTEST_EXTERN mutex arenasLock;
+
+// Identifies the current thread, which is all that tests need to tell threads
+// apart, without including <thread>
+inline const void* ThreadTag() {
+  static thread_local char tag;
+  return &tag;
+}
+
+inline Arena& ThreadArena() {
+  // Give the arena back when the thread ends
+  static thread_local struct ArenaOwner {
+    Arena* arena;
+    ~ArenaOwner() {
+      if (arena == nullptr) return;
+      lock_guard<mutex> guard(arenasLock);
+      freeArenas.push_back(arena);
+    }
+  } owner = {nullptr};
+  if (owner.arena == nullptr) {
+    lock_guard<mutex> guard(arenasLock);
+    if (freeArenas.empty()) {
+      owner.arena = new Arena;
+      arenas.push_back(owner.arena);
+    } else {
+      owner.arena = freeArenas.back();
+      freeArenas.pop_back();
+    }
+  }
+  return *owner.arena;
+}
+
+// Copy a string to the thread's arena, to live as long as test data
+inline const char* CopyToArena(const string& source) {
+  char* str = static_cast<char*>(ThreadArena().Allocate(source.size() + 1));
+  memcpy(str, source.c_str(), source.size() + 1);
+  return str;
+}
+
+// Release all the data at once, so all the test data must not be used anymore
+inline void ReleaseArenas() {
+  lock_guard<mutex> guard(arenasLock);
+  for (Arena* arena : arenas) {
+    arena->Release();
+  }
+}
+
+/* ========== Timing ========== */
+
+LIGHTEST_EXTERN bool useTsc;  // Use USE_TSC() to set to true
+
+// Monotonic wall time in ns
+inline long long SteadyNow() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Time stamp counter is much cheaper to read than steady_clock, but its rate
+// must be calibrated against steady_clock first
+LIGHTEST_EXTERN double tscNsPerTick;  // 0 => not calibrated
+LIGHTEST_EXTERN unsigned long long tscBaseTicks;
+LIGHTEST_EXTERN long long tscBaseNs;
+
+#ifdef _TSC_
+inline unsigned long long ReadTsc() {
+#ifdef _MSC_VER
+  return __rdtsc();
+#else
+  return __builtin_ia32_rdtsc();
+#endif
+}
+#endif
+
+inline void CalibrateTsc() {
+#ifdef _TSC_
+  long long startNs = SteadyNow();
+  unsigned long long startTicks = ReadTsc();
+  while (SteadyNow() - startNs < 10000000) {  // 10 ms
+  }
+  long long ns = SteadyNow() - startNs;
+  unsigned long long ticks = ReadTsc() - startTicks;
+  tscBaseTicks = startTicks, tscBaseNs = startNs;
+  tscNsPerTick = double(ns) / ticks;
+#endif
+}
+
+// Wall time in ns, from TSC if calibrated, otherwise from steady_clock
+inline long long WallNow() {
+#ifdef _TSC_
+  if (tscNsPerTick > 0) {
+    return tscBaseNs + (long long)((ReadTsc() - tscBaseTicks) * tscNsPerTick);
   }
+#endif
+  return SteadyNow();
+}
+
+// CPU time of the current thread in ns
+inline long long ThreadCpuNow() {
+#if defined(_LINUX_) || defined(_MAC_)
+  timespec time;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return time.tv_sec * 1000000000LL + time.tv_nsec;
+#elif defined(_WIN_)
+  FILETIME creation, exit, kernel, user;
+  GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+  ULARGE_INTEGER kernelTime, userTime;  // Unit: 100 ns
+  kernelTime.LowPart = kernel.dwLowDateTime;
+  kernelTime.HighPart = kernel.dwHighDateTime;
+  userTime.LowPart = user.dwLowDateTime;
+  userTime.HighPart = user.dwHighDateTime;
+  return (long long)(kernelTime.QuadPart + userTime.QuadPart) * 100;
+#else
+  return (long long)(double(clock()) / CLOCKS_PER_SEC * 1e9);
+#endif
 }
 
+inline double NsToMs(long long ns) { return ns / 1e6; }
+
+const long long startTime = WallNow();  // Start of the run
+
 /* ========== Data ========== */
 
-bool toOutput = true;              // Use NO_OUTPUT() to set to false
-bool failedReturnNoneZero = true;  // Use RETURN_ZERO() to set to false
+// Use NO_OUTPUT() to set to false
+LIGHTEST_EXTERN bool toOutput LIGHTEST_INIT(= true);
+// Use RETURN_ZERO() to set to false
+LIGHTEST_EXTERN bool failedReturnNoneZero LIGHTEST_INIT(= true);
+// Use RECORD_FAILURES_ONLY() to set to true
+LIGHTEST_EXTERN bool recordFailuresOnly;
+// Use FAST_EXIT() to set to true
+LIGHTEST_EXTERN bool fastExit;
 
-enum DataType { DATA_SET, DATA_REQ, DATA_UNCAUGHT_ERROR };
+enum DataType {
+  DATA_SET,
+  DATA_REQ,
+  DATA_UNCAUGHT_ERROR,
+  DATA_TIMEOUT,
+  // Types of data from extensions
+  DATA_BENCH,
+  DATA_BENCH_REGRESSION,
+  DATA_PERF_COUNTERS,
+  DATA_CRASH
+};
 
 // Unitlity for transfering clock_t to ms,
 // for on Linux clock_t's unit is us, while on Windows it's ms
@@ -77,13 +465,34 @@ inline double TimeToMs(clock_t time) {
 #define PRINT_LABEL(color, label)               \
   do {                                          \
     lightest::SetColor(color);                  \
-    std::cout << label;                         \
+    lightest::Output() << label;                \
     lightest::SetColor(lightest::Color::Reset); \
   } while (0)
 
+// A failed test action, e.g. to be written to reports
+typedef struct {
+  const char* kind;  // e.g. "REQ", shown as the type of the failure
+  string message;
+  const char* file;  // nullptr if unknown
+  unsigned int line;
+} Failure;
+
 // All test data classes should extend from Data
+// Data are allocated from the arena of the current thread, or from an given
+// arena by new (arena) DataClass(...). Deleting data only runs destructors
+// Arenas free data without running destructors, so members of data mustn't
+// own memory or resources (e.g. std::string or std::vector). Copy strings by
+// CopyToArena(), and allocate arrays from the arena, like DataBench does
 class Data {
  public:
+  static void* operator new(size_t size) {
+    return ThreadArena().Allocate(size);
+  }
+  static void* operator new(size_t size, Arena& arena) {
+    return arena.Allocate(size);
+  }
+  static void operator delete(void*) {}
+  static void operator delete(void*, Arena&) {}
   // For outputting
   virtual void Print() const = 0;
   void SetTabs(unsigned int tabs) { this->tabs = tabs; }
@@ -93,38 +502,95 @@ class Data {
     // Must this->tabs - 1 first,
     // for this->tabs of global tests will be set to
     // 1
-    for (unsigned int tabs = this->tabs - 1; tabs > 0; tabs--) cout << "   ";
-    return cout;
+    for (unsigned int tabs = this->tabs - 1; tabs > 0; tabs--) {
+      Output() << "   ";
+    }
+    return Output();
   }
   // Offer type to enable transfer Data to exact class of test data
   virtual DataType Type() const = 0;
   virtual const bool GetFailed() const = 0;
+  // Describe the failure of failed data, overridden by types which may fail
+  virtual Failure GetFailure() const {
+    return Failure{"FAIL", "Failed", nullptr, 0};
+  }
   virtual ~Data() {}
+  // Next son of the same DataSet, nullptr for the last
+  const Data* GetNext() const { return next; }
 
  private:
+  friend class DataSet;
+  friend class Testing;
   unsigned int tabs;
+  Data* next;  // Next son of the same DataSet
 };
 
 // Contain test actions on current level and sub tests' data
 // Recursively call Print() to output
 class DataSet : public Data {
  public:
-  DataSet(const char* name_) : failed(false), duration(0), name(name_) {}
+  DataSet(const char* name_)
+      : failed(false),
+        duration(0),
+        cpuDuration(0),
+        firstSon(nullptr),
+        lastSon(nullptr),
+        sonsNum(0),
+        reqsNum(0),
+        failedReqsNum(0),
+        skippedReqsNum(0),
+        name(name_),
+        subs() {}
   void Add(Data* son) {
-    son->SetTabs(GetTabs() + 1);
+    Link(son);
     if (son->GetFailed()) failed = true;
-    sons.push_back(son);
+    if (son->Type() == DATA_REQ) {
+      reqsNum++;
+      if (son->GetFailed()) failedReqsNum++;
+    } else if (son->Type() == DATA_SET) {
+      AddSub(static_cast<const DataSet*>(son));
+    }
+  }
+  // Count a son without keeping it, e.g. a test whose data are not needed
+  void AddDropped(const Data* son) {
+    if (son->GetFailed()) failed = true;
+    if (son->Type() == DATA_SET) AddSub(static_cast<const DataSet*>(son));
+  }
+  // Mark as failed by sons which can't be restored, e.g. reading a file
+  void MarkFailed() { failed = true; }
+  // Count passing REQs which are not recorded as sons
+  void AddPassedReqs(unsigned int num) {
+    reqsNum += num;
+    skippedReqsNum += num;
+  }
+  // Move all the sons to another DataSet, e.g. to merge data collected on
+  // other threads, with counts of dropped sons as well
+  void MoveSons(DataSet* target) {
+    for (Data *item = firstSon, *next; item != nullptr; item = next) {
+      next = item->next;
+      target->Link(item);
+    }
+    if (failed) target->failed = true;
+    target->reqsNum += reqsNum, target->failedReqsNum += failedReqsNum;
+    target->skippedReqsNum += skippedReqsNum;
+    target->MergeSubs(subs);
+    firstSon = lastSon = nullptr;
+    sonsNum = reqsNum = failedReqsNum = skippedReqsNum = 0;
+    subs = Aggregates();
+  }
+  // Unit: ns
+  void End(long long duration, long long cpuDuration) {
+    this->duration = duration, this->cpuDuration = cpuDuration;
   }
-  void End(clock_t duration) { this->duration = duration; }
   void PrintSons() const {
-    for (const Data* item : sons) {
+    for (const Data* item = firstSon; item != nullptr; item = item->next) {
       item->Print();
     }
   }
   void Print() const {
     PrintTabs();
     PRINT_LABEL(Color::Blue, " BEGIN ");
-    cout << " " << name << endl;
+    Output() << " " << name << '\n';
     PrintSons();
     PrintTabs();
     if (failed) {
@@ -132,31 +598,107 @@ class DataSet : public Data {
     } else {
       PRINT_LABEL(Color::Green, " PASS  ");
     }
-    cout << " " << name << " " << TimeToMs(duration) << " ms" << endl;
+    Output() << " " << name << " " << NsToMs(duration) << " ms\n";
   }
   DataType Type() const { return DATA_SET; }
   const bool GetFailed() const { return failed; }
-  clock_t GetDuration() const { return duration; }
+  // Wall time (ms) used by the test including sub tests
+  double GetDuration() const { return NsToMs(duration); }
+  // CPU time (ms) of the thread running the test, including sub tests run on
+  // the same thread
+  double GetCpuDuration() const { return NsToMs(cpuDuration); }
   const char* GetName() const { return name; }
-  unsigned int GetSonsNum() const { return sons.size(); }
+  unsigned int GetSonsNum() const { return sonsNum; }
+  // Sons are linked, e.g. for iterating them without callbacks
+  const Data* GetFirstSon() const { return firstSon; }
+  // Counts of REQs directly in this test, including unrecorded passing ones
+  unsigned int GetReqsNum() const { return reqsNum; }
+  unsigned int GetFailedReqsNum() const { return failedReqsNum; }
+  // Aggregates kept as sub tests are added (including dropped ones), so that
+  // reports needn't walk the tree
+  // Direct sub tests, e.g. TESTs of the run, and their time (ms)
+  unsigned int GetSubsNum() const { return subs.num; }
+  unsigned int GetFailedSubsNum() const { return subs.failedNum; }
+  double GetSubsDuration() const { return NsToMs(subs.duration); }
+  double GetSubsCpuDuration() const { return NsToMs(subs.cpuDuration); }
+  double GetSubsMinDuration() const { return NsToMs(subs.minDuration); }
+  double GetSubsMaxDuration() const { return NsToMs(subs.maxDuration); }
+  // Sub tests of all levels
+  unsigned int GetAllSubsNum() const { return subs.allNum; }
+  unsigned int GetAllFailedSubsNum() const { return subs.allFailedNum; }
+  // REQs of the test and sub tests of all levels
+  unsigned int GetAllReqsNum() const { return reqsNum + subs.allReqsNum; }
+  unsigned int GetAllFailedReqsNum() const {
+    return failedReqsNum + subs.allFailedReqsNum;
+  }
   // Should offer a callback to iterate test actions and sub tests' data
-  void IterSons(function<void(const Data*)> func) const {
-    for (const Data* item : sons) {
+  // A template, so that callbacks are inlined instead of called indirectly
+  template <typename Func>
+  void IterSons(Func func) const {
+    for (const Data* item = firstSon; item != nullptr; item = item->next) {
       func(item);
     }
   }
   ~DataSet() {
-    for (const Data* item : sons) {
+    for (Data *item = firstSon, *next; item != nullptr; item = next) {
+      next = item->next;
       delete item;
     }
   }
 
  private:
+  // Aggregates of sub tests, durations in ns
+  typedef struct {
+    unsigned int num, failedNum, allNum, allFailedNum;
+    unsigned int allReqsNum, allFailedReqsNum;
+    long long duration, cpuDuration, minDuration, maxDuration;
+  } Aggregates;
+  void Link(Data* son) {
+    son->SetTabs(GetTabs() + 1);
+    son->next = nullptr;
+    if (lastSon == nullptr) {
+      firstSon = son;
+    } else {
+      lastSon->next = son;
+    }
+    lastSon = son;
+    sonsNum++;
+  }
+  // Sub tests are added after they end, so their aggregates are final
+  void AddSub(const DataSet* sub) {
+    Aggregates one = Aggregates();
+    one.num = one.allNum = 1;
+    one.failedNum = one.allFailedNum = sub->failed ? 1 : 0;
+    one.duration = one.minDuration = one.maxDuration = sub->duration;
+    one.cpuDuration = sub->cpuDuration;
+    MergeSubs(one);
+    subs.allNum += sub->subs.allNum;
+    subs.allFailedNum += sub->subs.allFailedNum;
+    subs.allReqsNum += sub->GetAllReqsNum();
+    subs.allFailedReqsNum += sub->GetAllFailedReqsNum();
+  }
+  void MergeSubs(const Aggregates& other) {
+    if (other.num == 0) return;
+    if (subs.num == 0 || other.minDuration < subs.minDuration) {
+      subs.minDuration = other.minDuration;
+    }
+    if (subs.num == 0 || other.maxDuration > subs.maxDuration) {
+      subs.maxDuration = other.maxDuration;
+    }
+    subs.num += other.num, subs.failedNum += other.failedNum;
+    subs.allNum += other.allNum, subs.allFailedNum += other.allFailedNum;
+    subs.allReqsNum += other.allReqsNum;
+    subs.allFailedReqsNum += other.allFailedReqsNum;
+    subs.duration += other.duration, subs.cpuDuration += other.cpuDuration;
+  }
   bool failed;
-  clock_t duration;
-  // Data of test actions and sub tests
-  vector<const Data*> sons;
+  long long duration, cpuDuration;
+  // Data of test actions and sub tests, linked by Data::next
+  Data *firstSon, *lastSon;
+  unsigned int sonsNum;
+  unsigned int reqsNum, failedReqsNum, skippedReqsNum;
   const char* name;
+  Aggregates subs;
 };
 
 // Data classes for test actions should to extend from DataUnit,
@@ -174,11 +716,12 @@ class DataUnit {
 };
 
 // Data class of REQ assertions
-template <class T, class U>  // Different types for e.g. <int> == <double>
+// Operands are only rendered to strings when the assertion fails, while
+// actual & expected of passing ones are nullptr
 class DataReq : public Data, public DataUnit {
  public:
-  DataReq(const char* file_, unsigned int line_, const T& actual_,
-          const U& expected_, const char* operator__, const char* expr_,
+  DataReq(const char* file_, unsigned int line_, const char* actual_,
+          const char* expected_, const char* operator__, const char* expr_,
           bool failed_)
       : DataUnit(file_, line_),
         actual(actual_),
@@ -191,25 +734,30 @@ class DataReq : public Data, public DataUnit {
     if (failed) {
       PrintTabs();
       PRINT_LABEL(Color::Red, " FAIL  ");
-      cout << " " << file << ":" << line << ":"
-           << " REQ [" << expr << "] failed" << endl;
+      Output() << " " << file << ":" << line << ":"
+               << " REQ [" << expr << "] failed\n";
       PrintTabs() << "    ├───── ACTUAL: "
                   << string(string(operator_).size(), ' ') << " " << actual
-                  << endl;
+                  << '\n';
       PrintTabs() << "    └─── EXPECTED: " << operator_ << " " << expected
-                  << endl;
+                  << '\n';
     }
   }
   DataType Type() const { return DATA_REQ; }
-  const T GetActual() const { return actual; }
-  const U GetExpected() const { return GetExpected; }
+  const char* GetActual() const { return actual; }
+  const char* GetExpected() const { return expected; }
   const char* GetOperator() const { return operator_; }
   const char* GetExpr() const { return expr; }
   const bool GetFailed() const { return failed; }
+  Failure GetFailure() const {
+    return Failure{"REQ",
+                   string("REQ [") + expr + "] failed, actual: " + actual +
+                       ", expected: " + operator_ + " " + expected,
+                   file, line};
+  }
 
  private:
-  const T actual;
-  const U expected;
+  const char *actual, *expected;
   const char *operator_, *expr;
   const bool failed;
 };
@@ -222,266 +770,1047 @@ class DataUncaughtError : public Data, public DataUnit {
   void Print() const {
     PrintTabs();
     PRINT_LABEL(Color::Red, " ERROR ");
-    cout << " " << file << ":" << line << ": Uncaught error [" << errorMsg
-         << "]" << endl;
+    Output() << " " << file << ":" << line << ": Uncaught error ["
+             << errorMsg << "]\n";
   }
   DataType Type() const { return DATA_UNCAUGHT_ERROR; }
   const bool GetFailed() const { return true; }
+  const char* GetErrorMsg() const { return errorMsg; }
+  Failure GetFailure() const {
+    return Failure{"ERROR", string("Uncaught error [") + errorMsg + "]", file,
+                   line};
+  }
 
  private:
   const char* errorMsg;
 };
 
+// Data of a TEST or SUB running out of its time limit
+class DataTimeout : public Data {
+ public:
+  DataTimeout(const char* path_, unsigned int limit_)
+      : path(path_), limit(limit_) {}
+  void Print() const {
+    PrintTabs();
+    PRINT_LABEL(Color::Red, "TIMEOUT");
+    Output() << " " << path << " timed out after " << limit << " ms\n";
+  }
+  DataType Type() const { return DATA_TIMEOUT; }
+  const bool GetFailed() const { return true; }
+  // Names of the test and its parents, e.g. Test/SubTest
+  const char* GetPath() const { return path; }
+  unsigned int GetLimit() const { return limit; }  // Unit: ms
+  Failure GetFailure() const {
+    return Failure{"TIMEOUT",
+                   string(path) + " timed out after " + to_string(limit) +
+                       " ms",
+                   nullptr, 0};
+  }
+
+ private:
+  const char* path;
+  unsigned int limit;
+};
+
+/* ========== Serialization ========== */
+
+// Appends data to a byte string, e.g. to send them to another process
+class Encoder {
+ public:
+  template <typename T>
+  void Put(const T& value) {
+    bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+  void PutString(const char* str) {
+    if (str == nullptr) {
+      Put<unsigned int>(0);
+      return;
+    }
+    unsigned int size = (unsigned int)strlen(str);
+    Put<unsigned int>(size + 1);  // 0 is for nullptr
+    bytes.append(str, size);
+  }
+  string bytes;
+};
+
+// Reads data from a byte string, copying strings to the thread's arena
+class Decoder {
+ public:
+  Decoder(const char* begin) : pos(begin) {}
+  template <typename T>
+  T Get() {
+    T value;
+    memcpy(&value, pos, sizeof(value));
+    pos += sizeof(value);
+    return value;
+  }
+  const char* GetString() {
+    unsigned int size = Get<unsigned int>();
+    if (size == 0) return nullptr;
+    char* str = static_cast<char*>(ThreadArena().Allocate(size));
+    memcpy(str, pos, size - 1);
+    str[size - 1] = '\0';
+    pos += size - 1;
+    return str;
+  }
+
+ private:
+  const char* pos;
+};
+
+// Codecs of data types from extensions or users, e.g.
+// SetDataCodec(DATA_BENCH, DataCodec{EncodeBench, DecodeBench});
+// Data of types without codecs are dropped when sent between processes
+typedef struct {
+  void (*encode)(const Data* data, Encoder& encoder);
+  Data* (*decode)(Decoder& decoder);
+} DataCodec;
+// Indexed by types, got by a function when adding, like listeners
+inline vector<DataCodec>& DataCodecs() {
+  static vector<DataCodec> codecs;
+  return codecs;
+}
+LIGHTEST_EXTERN vector<DataCodec>& dataCodecs LIGHTEST_INIT(= DataCodecs());
+
+inline void SetDataCodec(int type, const DataCodec& codec) {
+  vector<DataCodec>& codecs = DataCodecs();
+  if (codecs.size() <= size_t(type)) {
+    codecs.resize(size_t(type) + 1, DataCodec{nullptr, nullptr});
+  }
+  codecs[size_t(type)] = codec;
+}
+
+// Set a codec during static initialization, e.g. by an extension
+class CodecRegistering {
+ public:
+  CodecRegistering(DataType type, const DataCodec& codec) {
+    SetDataCodec(type, codec);
+  }
+};
+
+// Data of the core types and sons of DataSets are encoded here, and data of
+// other types by their codecs, e.g. to send them to another process, or to
+// copy data still being changed by tests
+const unsigned char dataSetEnd = 0xFF;  // Marks the end of sons of a DataSet
+
+inline bool CanEncode(const Data* data) {
+  DataType type = data->Type();
+  return type == DATA_SET || type == DATA_REQ || type == DATA_UNCAUGHT_ERROR ||
+         type == DATA_TIMEOUT ||
+         (size_t(type) < dataCodecs.size() && dataCodecs[type].encode);
+}
+
+inline void EncodeData(const Data* data, Encoder& encoder) {
+  encoder.Put<unsigned char>((unsigned char)data->Type());
+  switch (data->Type()) {
+    case DATA_SET: {
+      const DataSet* set = static_cast<const DataSet*>(data);
+      encoder.PutString(set->GetName());
+      encoder.Put<unsigned int>(set->GetTabs());
+      // Back to ns, rounded
+      encoder.Put<long long>((long long)(set->GetDuration() * 1e6 + 0.5));
+      encoder.Put<long long>((long long)(set->GetCpuDuration() * 1e6 + 0.5));
+      // Failing sons may not be encoded, e.g. of types without codecs
+      encoder.Put<bool>(set->GetFailed());
+      unsigned int skippedReqsNum = set->GetReqsNum();
+      set->IterSons([&encoder, &skippedReqsNum](const Data* son) {
+        if (son->Type() == DATA_REQ) skippedReqsNum--;
+        if (CanEncode(son)) EncodeData(son, encoder);
+      });
+      encoder.Put<unsigned char>(dataSetEnd);
+      encoder.Put<unsigned int>(skippedReqsNum);
+      break;
+    }
+    case DATA_REQ: {
+      const DataReq* req = static_cast<const DataReq*>(data);
+      encoder.PutString(req->GetFileName());
+      encoder.Put<unsigned int>(req->GetLine());
+      encoder.PutString(req->GetActual());
+      encoder.PutString(req->GetExpected());
+      encoder.PutString(req->GetOperator());
+      encoder.PutString(req->GetExpr());
+      encoder.Put<bool>(req->GetFailed());
+      break;
+    }
+    case DATA_UNCAUGHT_ERROR: {
+      const DataUncaughtError* error =
+          static_cast<const DataUncaughtError*>(data);
+      encoder.PutString(error->GetFileName());
+      encoder.Put<unsigned int>(error->GetLine());
+      encoder.PutString(error->GetErrorMsg());
+      break;
+    }
+    case DATA_TIMEOUT: {
+      const DataTimeout* timeout = static_cast<const DataTimeout*>(data);
+      encoder.PutString(timeout->GetPath());
+      encoder.Put<unsigned int>(timeout->GetLimit());
+      break;
+    }
+    default:
+      dataCodecs[data->Type()].encode(data, encoder);
+  }
+}
+
+// Returns nullptr at the end of sons of a DataSet
+inline Data* DecodeData(Decoder& decoder) {
+  unsigned char type = decoder.Get<unsigned char>();
+  if (type == dataSetEnd) return nullptr;
+  switch (type) {
+    case DATA_SET: {
+      DataSet* set = new DataSet(decoder.GetString());
+      set->SetTabs(decoder.Get<unsigned int>());  // Give correct tabs to sons
+      long long duration = decoder.Get<long long>();
+      long long cpuDuration = decoder.Get<long long>();
+      bool failed = decoder.Get<bool>();
+      while (Data* son = DecodeData(decoder)) set->Add(son);
+      set->AddPassedReqs(decoder.Get<unsigned int>());
+      if (failed && !set->GetFailed()) set->MarkFailed();
+      set->End(duration, cpuDuration);
+      return set;
+    }
+    case DATA_REQ: {
+      const char* file = decoder.GetString();
+      unsigned int line = decoder.Get<unsigned int>();
+      const char* actual = decoder.GetString();
+      const char* expected = decoder.GetString();
+      const char* operator_ = decoder.GetString();
+      const char* expr = decoder.GetString();
+      return new DataReq(file, line, actual, expected, operator_, expr,
+                         decoder.Get<bool>());
+    }
+    case DATA_UNCAUGHT_ERROR: {
+      const char* file = decoder.GetString();
+      unsigned int line = decoder.Get<unsigned int>();
+      return new DataUncaughtError(file, line, decoder.GetString());
+    }
+    case DATA_TIMEOUT: {
+      const char* path = decoder.GetString();
+      return new DataTimeout(path, decoder.Get<unsigned int>());
+    }
+    default:
+      // Unknown types are never encoded, so the bytes are corrupted
+      if (size_t(type) >= dataCodecs.size() || !dataCodecs[type].decode) {
+        cerr << "lightest: corrupted data of unknown type " << int(type)
+             << endl;
+        exit(1);
+      }
+      return dataCodecs[type].decode(decoder);
+  }
+}
+
+/* ========== Filter ========== */
+
+// Use FILTER(patterns) to only run tests whose paths (e.g. Test/SubTest)
+// match, and EXCLUDE(patterns) to skip tests whose paths match
+// Patterns are globs separated by ':', in which * matches any chars and ?
+// matches one char
+LIGHTEST_EXTERN vector<string> filters, excludes;
+// Use LIST_TESTS() to list tests instead of running
+LIGHTEST_EXTERN bool listTests;
+
+inline void AddPatterns(vector<string>& list, const string& patterns) {
+  string::size_type begin = 0, end;
+  do {
+    end = patterns.find(':', begin);
+    string pattern = patterns.substr(begin, end - begin);
+    if (!pattern.empty()) list.push_back(pattern);
+    begin = end + 1;
+  } while (end != string::npos);
+}
+
+// Whether a glob matches the text, or may match a longer text starting with
+// the text if prefix is true
+inline bool GlobMatch(const char* pattern, const char* text, bool prefix) {
+  const char *star = nullptr, *starText = nullptr;  // For backtracking
+  while (*text != '\0') {
+    if (*pattern == '*') {
+      star = pattern++, starText = text;
+    } else if (*pattern != '\0' && (*pattern == '?' || *pattern == *text)) {
+      pattern++, text++;
+    } else if (star != nullptr) {
+      pattern = star + 1, text = ++starText;
+    } else {
+      return false;
+    }
+  }
+  if (prefix) return true;
+  while (*pattern == '*') pattern++;
+  return *pattern == '\0';
+}
+
+inline bool AnyGlobMatch(const vector<string>& patterns, const string& text,
+                         bool prefix) {
+  for (const string& pattern : patterns) {
+    if (GlobMatch(pattern.c_str(), text.c_str(), prefix)) return true;
+  }
+  return false;
+}
+
+inline bool Filtering() { return !filters.empty() || !excludes.empty(); }
+
+// A test is selected if its path or the path of one of its parents matches
+// the filters
+inline bool IsSelected(const string& path, bool parentSelected) {
+  return filters.empty() || parentSelected ||
+         AnyGlobMatch(filters, path, false);
+}
+
+// Whether to run a test by its path. A test not selected still runs if its
+// sub tests may be selected, for SUBs are only defined when their parents run
+inline bool ShouldRun(const string& path, bool parentSelected) {
+  if (AnyGlobMatch(excludes, path, false)) return false;
+  return IsSelected(path, parentSelected) ||
+         AnyGlobMatch(filters, path + "/", true);
+}
+
 /* ========== Register ========== */
 
+inline void RunSub(RegisterContext& ctx, const char* name,
+                   const SubBody& body);
+
 class Register {
  public:
   Register(const char* name) { testData = new DataSet(name); }
   Register() { testData = NULL; }
-  typedef struct {
-    DataSet* testData;
-    int argn;
-    char** argc;
-  } Context;
-  // Register a CONFIG, TEST, or DATA
-  void Add(const char* name, function<void(Context&)> callerFunc) {
-    registerList.push_back({name, callerFunc});
+  typedef RegisterContext Context;
+  // Register a SUB, whose body is destroyed with the register
+  void Add(const char* name, const SubBody& body) {
+    subs.resize(registerList.size());
+    subs.push_back(body);
+    registerList.push_back(Registered{name, nullptr});
   }
+  // Take callbacks linked by Registering nodes before main
+  inline void Load(const RegisterList& list);
+  // Run registered callbacks one by one
   void RunRegistered() {
-    Context ctx = Context{testData, argn, argc};
-    for (const signedFuncWrapper& item : registerList) {
-      item.callerFunc(ctx);
+    for (size_t i = 0; i < registerList.size(); i++) RunOne(i, testData);
+  }
+  // Only keep callbacks passing the check by their indexes
+  template <typename Func>
+  void Filter(Func keep) {
+    size_t kept = 0;
+    for (size_t i = 0; i < registerList.size(); i++) {
+      if (!keep(i)) {
+        if (i < subs.size()) Destroy(subs[i]);
+        continue;
+      }
+      registerList[kept] = registerList[i];
+      if (i < subs.size()) subs[kept] = subs[i];
+      kept++;
+    }
+    registerList.resize(kept);
+    if (subs.size() > kept) subs.resize(kept);
+  }
+  // Run a single callback, for extensions scheduling callbacks by themselves
+  void RunOne(size_t index, DataSet* collector) const {
+    Context ctx = Context{collector, argn, argc, index};
+    if (registerList[index].callerFunc != nullptr) {
+      registerList[index].callerFunc(ctx);
+    } else {
+      RunSub(ctx, registerList[index].name, subs[index]);
     }
   }
+  size_t GetRegisteredNum() const { return registerList.size(); }
+  const char* GetName(size_t index) const { return registerList[index].name; }
   // Restore argn & argc for CONFIG
   static void SetArg(int argn, char** argc) {
     Register::argn = argn, Register::argc = argc;
   }
+  Register(const Register&) = delete;
+  Register& operator=(const Register&) = delete;
+  ~Register() {
+    for (SubBody& body : subs) Destroy(body);
+  }
   DataSet* testData;
 
  private:
+  // CONFIGs, TESTs & DATAs are plain functions, loaded as plain structs, so
+  // that filtering & sharding lots of them only copy pairs of pointers
   typedef struct {
     const char* name;
-    function<void(Register::Context&)> callerFunc;
-  } signedFuncWrapper;
-  vector<signedFuncWrapper> registerList;
+    void (*callerFunc)(Context&);  // nullptr for a SUB
+  } Registered;
+  static void Destroy(SubBody& body) {
+    if (body.destroy != nullptr) body.destroy(body.lambda);
+    body.destroy = nullptr;
+  }
+  vector<Registered> registerList;
+  // Bodies of SUBs by the same indexes as registerList, which may be shorter
+  // than registerList when the last ones are plain functions
+  vector<SubBody> subs;
   static int argn;
   static char** argc;
 };
+#ifdef _LIGHTEST_DEFINITIONS_
 int Register::argn = 0;
 char** Register::argc = nullptr;
+#endif
+
+// Loaded from the lists of CONFIGs, TESTs & DATAs in main
+LIGHTEST_EXTERN Register globalRegisterConfig LIGHTEST_INIT((""));
+LIGHTEST_EXTERN Register globalRegisterTest LIGHTEST_INIT((""));
+LIGHTEST_EXTERN Register globalRegisterData LIGHTEST_INIT((""));
+
+/* ========== Runners ========== */
 
-Register globalRegisterConfig("");
-Register globalRegisterTest("");
-Register globalRegisterData("");
+// Extensions take over running tests by these, and the core runs them one by
+// one on the main thread without extensions
 
-class Registering {
+// Run TESTs one by one
+inline void RunSerially(Register& reg) { reg.RunRegistered(); }
+
+// Extensions may take over running TESTs, e.g. running them in processes
+LIGHTEST_EXTERN void (*testsRunner)(Register& reg);
+// Runs TESTs in the process when testsRunner isn't set, e.g. on threads by
+// parallel_ext.h
+LIGHTEST_EXTERN void (*inProcessRunner)(Register& reg)
+    LIGHTEST_INIT(= RunSerially);
+// Runs SUBs of a test instead of running them one by one, merging their data
+// under the lock if given, e.g. on threads by parallel_ext.h
+LIGHTEST_EXTERN void (*subsRunner)(Register& reg, mutex* dataLock);
+// Selects TESTs to run after filtering, e.g. by shards in shard_ext.h
+LIGHTEST_EXTERN void (*testsSelector)(Register& reg);
+
+/* ========== Commandline Flags ========== */
+
+// Handlers of commandline flags from extensions, resolved by ARG_CONFIG(), so
+// that arg_config_ext.h needn't include the extensions
+// Given a flag, e.g. "--junit", and its value (nullptr for flags without ones)
+typedef void (*FlagHandler)(const string& flag, const char* value);
+typedef struct {
+  // Names separated by spaces, and those of flags taking values end with '=',
+  // e.g. "--isolation --junit=", so that values may be given by the flags or
+  // by the arguments after them
+  const char* names;
+  FlagHandler handler;
+} FlagHandling;
+// Got by a function when adding, like listeners
+inline vector<FlagHandling>& FlagHandlings() {
+  static vector<FlagHandling> handlings;
+  return handlings;
+}
+
+// Add flags & their handler during static initialization, e.g. by an extension
+class FlagRegistering {
  public:
-  Registering(Register& reg, const char* name,
-              void (*callerFunc)(Register::Context&)) {
-    reg.Add(name, callerFunc);
+  FlagRegistering(const char* names, FlagHandler handler) {
+    FlagHandlings().push_back(FlagHandling{names, handler});
   }
 };
 
+// Parse a count given by a flag or an environment variable, e.g. --jobs 4, or
+// exit if it isn't a number from 0 to max, for a typo mustn't pass silently
+inline unsigned int ParseCount(const char* name, const char* value,
+                               unsigned int max = UINT_MAX) {
+  char* end = nullptr;
+  errno = 0;
+  long long count = strtoll(value, &end, 10);
+  if (end == value || *end != '\0' || errno == ERANGE || count < 0 ||
+      (unsigned long long)count > max) {
+    cerr << "lightest: invalid " << name << " '" << value << "'" << endl;
+    exit(1);
+  }
+  return (unsigned int)count;
+}
+
+class Listener;
+inline void AddListener(Listener* listener);
+
+inline Registering::Registering(Listener* listener)
+    : name(nullptr), callerFunc(nullptr), next(nullptr) {
+  AddListener(listener);
+}
+
+inline void Register::Load(const RegisterList& list) {
+  registerList.reserve(registerList.size() + list.size);
+  for (const Registering* item = list.head; item != nullptr;
+       item = item->next) {
+    registerList.push_back(Registered{item->name, item->callerFunc});
+  }
+}
+
+/* ========== Timeouts ========== */
+
+class Testing;
+
+// Time limit (ms) of every TEST and SUB, 0 for none, set by DEFAULT_TIMEOUT(ms)
+// of timeout_ext.h
+LIGHTEST_EXTERN unsigned int defaultTimeout;
+
+// Set by timeout_ext.h to watch deadlines of tests, which are only set with
+// the extension
+LIGHTEST_EXTERN void (*watchTest)(Testing* testing, unsigned int limit);
+LIGHTEST_EXTERN void (*unwatchTest)(Testing* testing);
+
+// Block the thread forever, e.g. one whose work is taken over by another
+inline void HangForever() {
+  while (true) {
+#if defined(_LINUX_) || defined(_MAC_)
+    pause();
+#elif defined(_WIN_)
+    Sleep(INFINITE);
+#else
+    this_thread::sleep_for(chrono::hours(1));
+#endif
+  }
+}
+
+/* ========== Listener ========== */
+
+// Listeners of events as tests run, e.g. to report results as they come out,
+// or to collect extra data around every test
+// Register one by LISTENER(type), or AddListener(). Events of tests running
+// parallelly may be called at the same time
+class Listener {
+ public:
+  // Called on the thread running the TEST or SUB
+  virtual void OnTestBegin(Testing&) {}
+  // Called on the thread using REQ, including passing ones not recorded by
+  // RECORD_FAILURES_ONLY()
+  virtual void OnAssertion(Testing&, const DataReq&) {}
+  // Called on the thread running the TEST or SUB, after its sub tests end and
+  // all its data are collected
+  virtual void OnTestEnd(Testing&) {}
+  // Called with data of a TEST when they are added to the results of the run,
+  // e.g. to report them. It's after OnTestEnd, and with process isolation,
+  // it's called in the main process when the data arrive
+  virtual void OnTestData(const DataSet*) {}
+  // Called after all the tests end, before the default outputs and DATA
+  virtual void OnRunEnd(const DataSet*) {}
+  virtual ~Listener() {}
+};
+// Without listeners, no virtual call is made
+// Got by a function when adding, for listeners in other files may be added
+// before the file defining global variables is initialized
+inline vector<Listener*>& Listeners() {
+  static vector<Listener*> list;
+  return list;
+}
+LIGHTEST_EXTERN vector<Listener*>& listeners LIGHTEST_INIT(= Listeners());
+
+inline void AddListener(Listener* listener) {
+  Listeners().push_back(listener);
+}
+
+inline void NotifyTestData(const DataSet* data) {
+  for (Listener* listener : listeners) listener->OnTestData(data);
+}
+
 /* ========== Testing ========== */
 
+// Whether to keep data of TESTs after they end, which extensions needing them
+// at the end should set to true
+// Only without default outputs, DATA processors, and other users of the data,
+// data of a TEST are dropped after listeners get them, to save memory
+LIGHTEST_EXTERN bool keepTree;
+
 // An instance of Testing is for adding test data and adding sub tests
+// REQ can be used on other threads. Their data are buffered per thread without
+// locks, and spliced into the test data at End(), so the threads should be
+// joined before the test returns
 class Testing {
  public:
   // level_: 1 => global tests, 2 => sub tests, 3 => sub sub tests ...
-  Testing(const char* name, unsigned int level_)
-      : level(level_), start(clock()), failed(false), reg(name) {
+  // index_: of a TEST in the register running it
+  Testing(const char* name, unsigned int level_,
+          const Testing* parent_ = nullptr, size_t index_ = 0)
+      : level(level_),
+        parent(parent_),
+        index(index_),
+        arena(DropsData() ? &ThreadArena() : nullptr),
+        arenaMark(arena != nullptr ? arena->GetMark() : Arena::Mark()),
+        start(WallNow()),
+        cpuStart(ThreadCpuNow()),
+        failed(false),
+        reg(name),
+        id(++testingCount),
+        runner(ThreadTag()),
+        buffers(nullptr),
+        watched(false),
+        timedOutLimit(0),
+        selected(true),
+        settled(false),
+        guarded(parent_ != nullptr && parent_->guarded) {
     reg.testData->SetTabs(level);  // Give correct tabs to its sons
+    if (Filtering()) {
+      selected = IsSelected(GetPath(), parent != nullptr && parent->selected);
+    }
+    if (defaultTimeout != 0) SetTimeout(defaultTimeout);
+    if (!listeners.empty()) {
+      for (Listener* listener : listeners) listener->OnTestBegin(*this);
+    }
   }
   // Add a test data unit of a REQ assertion
-  template <typename T,
-            typename U>  // Differnt type for e.g. <int> == <double>
-  void Req(const char* file, int line, const T& actual, const U& expected,
-           const char* operator_, const char* expr, bool failed) {
-    reg.testData->Add(new DataReq<T, U>(file, line, actual, expected, operator_,
-                                        expr, failed));
+  // A test not selected by filters only runs to define its selected sub tests,
+  // so it records nothing, see IsSelected()
+  void ReqPassed(const char* file, unsigned int line, const char* operator_,
+                 const char* expr) {
+    if (!selected) return;
+    if (recordFailuresOnly) {
+      CountPassedReq();
+      if (!listeners.empty()) {
+        DataReq passed(file, line, nullptr, nullptr, operator_, expr, false);
+        for (Listener* listener : listeners) {
+          listener->OnAssertion(*this, passed);
+        }
+      }
+      return;
+    }
+    RecordReq(
+        new DataReq(file, line, nullptr, nullptr, operator_, expr, false));
+  }
+  void ReqFailed(const char* file, unsigned int line, const char* actual,
+                 const char* expected, const char* operator_,
+                 const char* expr) {
+    if (!selected) return;
+    RecordReq(new DataReq(file, line, actual, expected, operator_, expr, true));
   }
   void UncaughtError(const char* file, unsigned int line,
                      const char* errorMsg) {
-    reg.testData->Add(new DataUncaughtError(file, line, errorMsg));
+    if (selected) Record(new DataUncaughtError(file, line, errorMsg));
+  }
+  // Time limit of the test including sub tests (ms), counted from its start
+  // Set it before starting threads using REQ in the test
+  void SetTimeout(unsigned int limit) {
+    if (watchTest == nullptr) return;  // Without timeout_ext.h
+    guarded = true;
+    long long used = (WallNow() - start) / 1000000;
+    watchTest(this, limit > used ? limit - (unsigned int)used : 0);
+    watched = true;
+  }
+  // Let the thread running the test record it as timed out when it ends, e.g.
+  // by a timeout handler which can't report it in place
+  void MarkTimedOut(unsigned int limit) { timedOutLimit = limit; }
+  // Add other data, e.g. data from extensions
+  void AddData(Data* data) {
+    if (selected) Record(data);
   }
-  void AddSub(const char* name, function<void(Register::Context&)> callerFunc) {
-    reg.Add(name, callerFunc);
+  void AddSub(const char* name, const SubBody& body) {
+    if (Filtering() && !ShouldRun(GetPath() + "/" + name, selected)) {
+      body.destroy(body.lambda);
+      return;
+    }
+    reg.Add(name, body);
   }
   DataSet* GetData() const { return reg.testData; }
   unsigned int GetLevel() const { return level; }
-  void End() {
-    reg.RunRegistered();  // Run sub tests
-    reg.testData->End(clock() - start);
+  const Testing* GetParent() const { return parent; }
+  long long GetElapsed() const { return WallNow() - start; }  // Unit: ns
+  // Tag of the thread running the test, see ThreadTag()
+  const void* GetRunner() const { return runner; }
+  // Index of the TEST in the register running it, see Register::RunOne()
+  size_t GetIndex() const { return index; }
+  // Whether the caller is the first to give the data of the TEST to its
+  // parent's, either End() or a timeout handler reporting it instead
+  bool Settle() const { return !settled.exchange(true); }
+  // Names of the test and its parents, e.g. Test/SubTest
+  string GetPath() const {
+    if (parent == nullptr) return GetData()->GetName();
+    return parent->GetPath() + "/" + GetData()->GetName();
+  }
+  // Copy of the data recorded so far, including those buffered on other
+  // threads and of ended sub tests (those run parallelly are only added when
+  // all of them end), e.g. to report the test while its thread still runs it
+  // Data of types without codecs are dropped, but failures are kept
+  DataSet* CopyData() const {
+    Encoder encoder;
+    unsigned int skippedReqsNum;
+    bool failed;
+    {
+      unique_lock<mutex> guard = LockData();
+      skippedReqsNum = reg.testData->GetReqsNum();
+      failed = reg.testData->GetFailed();
+      reg.testData->IterSons([&encoder, &skippedReqsNum](const Data* son) {
+        if (son->Type() == DATA_REQ) skippedReqsNum--;
+        if (CanEncode(son)) EncodeData(son, encoder);
+      });
+      // In the order of SpliceBuffers()
+      vector<const ThreadBuffer*> list;
+      for (const ThreadBuffer* buffer = buffers.load(memory_order_acquire);
+           buffer != nullptr; buffer = buffer->next) {
+        list.push_back(buffer);
+      }
+      for (size_t i = list.size(); i > 0; i--) {
+        for (const Data* item = list[i - 1]->first; item != nullptr;
+             item = item->next) {
+          if (item->GetFailed()) failed = true;
+          if (CanEncode(item)) EncodeData(item, encoder);
+        }
+        skippedReqsNum += list[i - 1]->passedReqsNum;
+      }
+      encoder.Put<unsigned char>(dataSetEnd);
+    }
+    DataSet* copy = new DataSet(reg.testData->GetName());
+    copy->SetTabs(level);
+    Decoder decoder(encoder.bytes.data());
+    while (Data* son = DecodeData(decoder)) copy->Add(son);
+    copy->AddPassedReqs(skippedReqsNum);
+    if (failed && !copy->GetFailed()) copy->MarkFailed();
+    return copy;
+  }
+  // End the test, and give its data to its parent's
+  void End(DataSet* parentData) {
+    SpliceBuffers();
+    // Run sub tests
+    if (subsRunner != nullptr) {
+      subsRunner(reg, guarded ? &dataLock : nullptr);
+    } else {
+      reg.RunRegistered();
+    }
+    if (unsigned int limit = timedOutLimit.exchange(0)) {
+      Record(new DataTimeout(CopyToArena(GetPath()), limit));
+    }
+    reg.testData->End(WallNow() - start, ThreadCpuNow() - cpuStart);
+    if (watched) unwatchTest(this);
+    // Reported as timed out, and another thread has taken over the work of
+    // this one, which can't go on
+    if (level == 1 && !Settle()) HangForever();
+    if (!listeners.empty()) {
+      for (Listener* listener : listeners) listener->OnTestEnd(*this);
+      // Runners of TESTs from extensions give data of TESTs by themselves
+      if (level == 1 && testsRunner == nullptr) NotifyTestData(reg.testData);
+    }
+    if (arena == nullptr) {
+      unique_lock<mutex> guard =
+          parent != nullptr ? parent->LockData() : unique_lock<mutex>();
+      parentData->Add(reg.testData);
+      return;
+    }
+    // Free all the data of the test at once
+    parentData->AddDropped(reg.testData);
+    arena->Rewind(arenaMark);
   }
 
  private:
+  // Data recorded on a thread other than the runner of the test
+  typedef struct ThreadBuffer {
+    const void* owner;  // See ThreadTag()
+    Data *first, *last;  // Linked by Data::next
+    unsigned int passedReqsNum;
+    ThreadBuffer* next;
+  } ThreadBuffer;
+  void CountPassedReq() {
+    if (ThreadTag() == runner) {
+      unique_lock<mutex> guard = LockData();
+      reg.testData->AddPassedReqs(1);
+    } else {
+      ThreadBuffer* buffer = GetBuffer();
+      unique_lock<mutex> guard = LockData();
+      buffer->passedReqsNum++;
+    }
+  }
+  void RecordReq(DataReq* req) {
+    Record(req);
+    if (!listeners.empty()) {
+      for (Listener* listener : listeners) listener->OnAssertion(*this, *req);
+    }
+  }
+  void Record(Data* data) {
+    if (ThreadTag() == runner) {
+      unique_lock<mutex> guard = LockData();
+      reg.testData->Add(data);
+      return;
+    }
+    ThreadBuffer* buffer = GetBuffer();
+    unique_lock<mutex> guard = LockData();
+    data->next = nullptr;
+    if (buffer->last == nullptr) {
+      buffer->first = data;
+    } else {
+      buffer->last->next = data;
+    }
+    buffer->last = data;
+  }
+  ThreadBuffer* GetBuffer() {
+    // Cache the buffer last used on this thread to skip searching
+    static thread_local unsigned long long cachedId = 0;
+    static thread_local ThreadBuffer* cachedBuffer = nullptr;
+    if (cachedId == id) return cachedBuffer;
+    const void* self = ThreadTag();
+    ThreadBuffer* buffer = buffers.load(memory_order_acquire);
+    while (buffer != nullptr && buffer->owner != self) buffer = buffer->next;
+    if (buffer == nullptr) {
+      // Lock-free push to the front of the list
+      buffer = new ThreadBuffer{self, nullptr, nullptr, 0, nullptr};
+      buffer->next = buffers.load(memory_order_relaxed);
+      while (!buffers.compare_exchange_weak(buffer->next, buffer,
+                                            memory_order_release,
+                                            memory_order_relaxed)) {
+      }
+    }
+    cachedId = id, cachedBuffer = buffer;
+    return buffer;
+  }
+  // Data of a test with a time limit, and of its sub tests, are changed under
+  // the lock, for the watchdog thread may copy them by CopyData()
+  // Tests without time limits pay nothing
+  unique_lock<mutex> LockData() const {
+    return guarded ? unique_lock<mutex>(dataLock) : unique_lock<mutex>();
+  }
+  // Splice buffered data in the order of the threads' first REQs
+  // They're allocated from the arenas of their threads (with strings of their
+  // operands), which rewinding the arena of this one can't free, so the data
+  // of the test are kept instead of dropped
+  void SpliceBuffers() {
+    unique_lock<mutex> guard = LockData();
+    vector<ThreadBuffer*> list;
+    for (ThreadBuffer* buffer = buffers.exchange(nullptr); buffer != nullptr;
+         buffer = buffer->next) {
+      list.push_back(buffer);
+      if (buffer->first != nullptr) arena = nullptr;
+    }
+    for (size_t i = list.size(); i > 0; i--) {
+      for (Data *item = list[i - 1]->first, *next; item != nullptr;
+           item = next) {
+        next = item->next;
+        reg.testData->Add(item);
+      }
+      reg.testData->AddPassedReqs(list[i - 1]->passedReqsNum);
+      delete list[i - 1];
+    }
+  }
+  // Data of a TEST are all allocated from the arena of its thread after the
+  // mark, unless sub tests run on other threads
+  bool DropsData() const {
+    return !keepTree && level == 1 && subsRunner == nullptr;
+  }
   const unsigned int level;
-  const clock_t start;  // No need to report.
+  const Testing* parent;  // nullptr for global tests
+  const size_t index;
+  Arena* arena;           // To free data of the test, nullptr to keep them
+  const Arena::Mark arenaMark;
+  const long long start, cpuStart;  // No need to report.
   bool failed;
   Register reg;
+  const unsigned long long id;  // Unique, for threads to find their buffers
+  const void* const runner;     // The thread running the test
+  atomic<ThreadBuffer*> buffers;
+  bool watched;   // Whether it has a deadline
+  atomic<unsigned int> timedOutLimit;  // See MarkTimedOut(), 0 for none
+  bool selected;  // Whether selected by filters, see IsSelected()
+  mutable atomic<bool> settled;  // See Settle()
+  atomic<bool> guarded;  // Whether it or a parent has a deadline
+  mutable mutex dataLock;  // See LockData()
+  static atomic<unsigned long long> testingCount;
 };
+#ifdef _LIGHTEST_DEFINITIONS_
+atomic<unsigned long long> Testing::testingCount(0);
+#endif
+
+// Run a SUB added by AddSub() in its parent, collecting its data
+inline void RunSub(RegisterContext& ctx, const char* name,
+                   const SubBody& body) {
+  Testing testing(name, body.parent->GetLevel() + 1, body.parent);
+  const char* errorMsg = CATCH(body.call(body.lambda, testing));
+  if (errorMsg) testing.UncaughtError(body.file, body.line, errorMsg);
+  testing.End(ctx.testData);
+}
 
 };  // namespace lightest
 
 /* ========== Registering Macros ========== */
 
-// Avoid undef or redefine buildin macro warning
-// Undef and then define again to have prettier file name
-#ifndef TEST_FILE_NAME
-#ifdef __FILE_NAME__
-#define TEST_FILE_NAME __FILE_NAME__
-#else
-#define TEST_FILE_NAME __FILE__
-#endif
-#endif
-
-// Untility for catching an error and return its detail as type const char*
-#define CATCH(sentence)                   \
-  ([&]() -> const char* {                 \
-    try {                                 \
-      sentence;                           \
-    } catch (const char* str) {           \
-      return str;                         \
-    } catch (const std::exception& err) { \
-      return err.what();                  \
-    } catch (...) {                       \
-      return "Unknown type error";        \
-    }                                     \
-    return nullptr;                       \
-  })()
-
 // To define user's configuarations
 // Pre-define argn and argc for user's configurations
-#define CONFIG(name)                                                       \
-  void name(int argn, char** argc);                                        \
-  void call_##name(lightest::Register::Context& ctx) {                     \
-    name(ctx.argn, ctx.argc);                                              \
-  }                                                                        \
-  lightest::Registering registering_##name(lightest::globalRegisterConfig, \
-                                           #name, call_##name);            \
-  void name(int argn, char** argc)
-
-// To define a test
-#define TEST(name)                                                           \
-  void name(lightest::Testing& testing);                                     \
-  void call_##name(lightest::Register::Context& ctx) {                       \
-    lightest::Testing testing(#name, 1);                                     \
-    const char* errorMsg = CATCH(name(testing));                             \
-    if (errorMsg) testing.UncaughtError(TEST_FILE_NAME, __LINE__, errorMsg); \
-    testing.End();                                                           \
-    ctx.testData->Add(testing.GetData()); /* Colletct data */                \
-  }                                                                          \
-  lightest::Registering registering_##name(lightest::globalRegisterTest,     \
-                                           #name, call_##name);              \
-  void name(lightest::Testing& testing)
+#define CONFIG(name)                                             \
+  void name(int argn, char** argc);                              \
+  void call_##name(lightest::Register::Context& ctx) {           \
+    name(ctx.argn, ctx.argc);                                    \
+  }                                                              \
+  lightest::Registering registering_##name(lightest::configList, \
+                                           #name, call_##name);  \
+  void name(int argn _MAYBE_UNUSED_, char** argc _MAYBE_UNUSED_)
+
+// To register a listener, after defining the type extended from Listener
+#define LISTENER(type)  \
+  type listener_##type; \
+  lightest::Registering listening_##type(&listener_##type);
 
 // To define a test data processor
 // Pre-define data to provide a readonly object containing all the test data
-#define DATA(name)                                                           \
-  void name(const lightest::DataSet* data);                                  \
-  void call_##name(lightest::Register::Context& ctx) { name(ctx.testData); } \
-  lightest::Registering registering_##name(lightest::globalRegisterData,     \
-                                           #name, call_##name);              \
-  void name(const lightest::DataSet* data)
-
-#define SUB(name)                                                     \
-  static std::function<void(lightest::Testing&)> name;                \
-  std::function<void(lightest::Register::Context&)> call_##name =     \
-      [&testing](lightest::Register::Context& ctx) {                  \
-        lightest::Testing testing_(#name, testing.GetLevel() + 1);    \
-        const char* errorMsg = CATCH(name(testing_));                 \
-        if (errorMsg)                                                 \
-          testing_.UncaughtError(TEST_FILE_NAME, __LINE__, errorMsg); \
-        testing_.End();                                               \
-        ctx.testData->Add(testing_.GetData());                        \
-      };                                                              \
-  testing.AddSub(#name, call_##name);                                 \
-  name = [=](lightest::Testing & testing)
+// Outputs are flushed around, so it can also write to std::cout in order
+#define DATA(name)                                              \
+  void name(const lightest::DataSet* data);                     \
+  void call_##name(lightest::Register::Context& ctx) {          \
+    lightest::FlushOutput();                                    \
+    name(ctx.testData);                                         \
+    lightest::FlushOutput();                                    \
+  }                                                             \
+  lightest::Registering registering_##name(lightest::dataList,  \
+                                           #name, call_##name); \
+  void name(const lightest::DataSet* data _MAYBE_UNUSED_)
 
 /* ========== Configuration Macros ========== */
 
 #define NO_COLOR() lightest::outputColor = false;
+// Redirect outputs to an ostream, a file descriptor, or a custom OutputSink
+#define OUTPUT_TO(os) lightest::SetOutputSink(new lightest::StreamSink(os));
+#define OUTPUT_TO_FD(fd) lightest::SetOutputSink(new lightest::FdSink(fd));
+#define OUTPUT_TO_SINK(sink) lightest::SetOutputSink(sink);
 #define NO_OUTPUT() lightest::toOutput = false;
 #define RETURN_ZERO() lightest::failedReturnNoneZero = false;
+// Read time from time stamp counter calibrated against steady_clock (x86)
+#define USE_TSC() lightest::useTsc = true;
+// Exit without releasing test data & global states at the end
+#define FAST_EXIT() lightest::fastExit = true;
+// Only count passing REQs instead of recording their data
+#define RECORD_FAILURES_ONLY() lightest::recordFailuresOnly = true;
+// Cut strings of REQ operands longer than n chars
+#define MAX_OPERAND_LENGTH(n) lightest::maxOperandLength = (n);
+// Only run tests whose paths match, or skip them, by globs separated by ':'
+#define FILTER(patterns) lightest::AddPatterns(lightest::filters, patterns);
+#define EXCLUDE(patterns) lightest::AddPatterns(lightest::excludes, patterns);
+// List names of tests instead of running them
+#define LIST_TESTS() lightest::listTests = true;
 
 /* ========== Main ========== */
 
+namespace lightest {
+
+// Entry points declared in lightest_lite.h, defined once in the program
+// They're shared by all the expanded TESTs, SUBs & REQs instead of being
+// expanded in each of them
+#ifdef _LIGHTEST_DEFINITIONS_
+_NOINLINE_ void RunTest(RegisterContext& ctx, const char* name,
+                        const char* file, unsigned int line,
+                        void (*func)(Testing&)) {
+  Testing testing(name, 1, nullptr, ctx.index);
+  const char* errorMsg = CATCH(func(testing));
+  if (errorMsg) testing.UncaughtError(file, line, errorMsg);
+  testing.End(ctx.testData);  // Colletct data
+}
+_NOINLINE_ void AddSub(Testing& testing, const char* name,
+                       const SubBody& body) {
+  testing.AddSub(name, body);
+}
+_NOINLINE_ void ReqPassed(Testing& testing, const char* file,
+                          unsigned int line, const char* operator_,
+                          const char* expr) {
+  testing.ReqPassed(file, line, operator_, expr);
+}
+_NOINLINE_ void ReqFailed(Testing& testing, const char* file,
+                          unsigned int line, const char* actual,
+                          const char* expected, const char* operator_,
+                          const char* expr) {
+  testing.ReqFailed(file, line, actual, expected, operator_, expr);
+}
+const char* CopyToArena(const char* source) {
+  return CopyToArena(string(source));
+}
+#endif
+
+// Output and process test data after running tests, returning the exit code
+inline int EndRun() {
+  globalRegisterData.testData = globalRegisterTest.testData;
+  for (Listener* listener : listeners) {
+    listener->OnRunEnd(globalRegisterData.testData);
+  }
+  // Optionally print the default outputs
+  if (toOutput) {
+    globalRegisterData.testData->PrintSons();
+  }
+  globalRegisterData.RunRegistered();
+  bool failed = globalRegisterData.testData->GetFailed();
+  if (failed)
+    PRINT_LABEL(Color::Red, " ✕ FAILED ✕ ");
+  else
+    PRINT_LABEL(Color::Green, " ✓ SUCCEEDED ✓ ");
+  PRINT_LABEL(Color::Blue, " " << NsToMs(WallNow() - startTime) << " ms used ");
+  Output() << "\n\n";
+  FlushOutput();
+  return failed && failedReturnNoneZero;
+}
+
+// Exit right after the run, leaving the memory of the test data and global
+// states to the system instead of releasing them. Reports are done in
+// OnRunEnd, and outputs are flushed here, while destructors & atexit
+// handlers are skipped
+inline void FastExit(int code) {
+  FlushOutput();
+  cerr.flush();
+  fflush(nullptr);
+  _Exit(code);
+}
+
+};  // namespace lightest
+
+#ifdef _LIGHTEST_DEFINITIONS_
 int main(int argn, char* argc[]) {
   // Offer arn & argc for CONFIG
   lightest::Register::SetArg(argn, argc);
   // Only test registerer need this, for test data will only be added in test
   // process
   lightest::globalRegisterTest.testData->SetTabs(0);
+  lightest::globalRegisterConfig.Load(lightest::configList);
+  lightest::globalRegisterTest.Load(lightest::testList);
+  lightest::globalRegisterData.Load(lightest::dataList);
   // 1. Run CONFIG
   // 2. Run tests (TEST)
   // 3. Pass test data to DATA registerer
   // 4. Run DATA
   lightest::globalRegisterConfig.RunRegistered();
-  lightest::globalRegisterTest.RunRegistered();
-  lightest::globalRegisterData.testData = lightest::globalRegisterTest.testData;
-  // Optionally print the default outputs
-  if (lightest::toOutput) {
-    lightest::globalRegisterData.testData->PrintSons();
+  if (lightest::Filtering()) {
+    lightest::globalRegisterTest.Filter([](size_t index) {
+      return lightest::ShouldRun(lightest::globalRegisterTest.GetName(index),
+                                 false);
+    });
   }
-  lightest::globalRegisterData.RunRegistered();
-  if (lightest::globalRegisterData.testData->GetFailed())
-    PRINT_LABEL(lightest::Color::Red, " ✕ FAILED ✕ ");
-  else
-    PRINT_LABEL(lightest::Color::Green, " ✓ SUCCEEDED ✓ ");
-  PRINT_LABEL(lightest::Color::Blue,
-              " " << lightest::TimeToMs(clock()) << " ms used ");
-  std::cout << std::endl << std::endl;
-  return lightest::globalRegisterData.testData->GetFailed() &&
-         lightest::failedReturnNoneZero;
+  if (lightest::testsSelector) {
+    lightest::testsSelector(lightest::globalRegisterTest);
+  }
+  if (lightest::listTests) {
+    for (size_t i = 0; i < lightest::globalRegisterTest.GetRegisteredNum();
+         i++) {
+      lightest::Output() << lightest::globalRegisterTest.GetName(i) << '\n';
+    }
+    lightest::FlushOutput();
+    return 0;
+  }
+  if (lightest::useTsc) lightest::CalibrateTsc();
+  lightest::keepTree = lightest::keepTree || lightest::toOutput ||
+                       lightest::globalRegisterData.GetRegisteredNum() > 0 ||
+                       lightest::testsRunner != nullptr;
+  if (lightest::testsRunner) {
+    lightest::testsRunner(lightest::globalRegisterTest);
+  } else {
+    lightest::inProcessRunner(lightest::globalRegisterTest);
+  }
+  int code = lightest::EndRun();
+  if (lightest::fastExit) lightest::FastExit(code);
+  // Release all the test data in one shot instead of deleting them one by one
+  lightest::ReleaseArenas();
+  return code;
 }
+#endif
 
 /* ========= Timer Macros =========== */
 
 // Unit: minisecond (ms)
 
-// Run once and messure the time
-#define TIMER(sentence)                         \
-  ([&]() -> double {                            \
-    clock_t start = clock();                    \
-    (sentence);                                 \
-    return lightest::TimeToMs(clock() - start); \
+// Run once and messure the (wall) time
+#define TIMER(sentence)                                   \
+  ([&]() -> double {                                      \
+    long long start = lightest::WallNow();                \
+    (sentence);                                           \
+    return lightest::NsToMs(lightest::WallNow() - start); \
   }())
 
 // Run several times and return the average time
 #define AVG_TIMER(sentence, times)                          \
   ([&]() -> double {                                        \
-    clock_t sum = 0, start;                                 \
+    long long sum = 0, start;                               \
     for (unsigned int index = 1; index <= times; index++) { \
-      start = clock();                                      \
+      start = lightest::WallNow();                          \
       (sentence);                                           \
-      sum += clock() - start;                               \
+      sum += lightest::WallNow() - start;                   \
     }                                                       \
-    return lightest::TimeToMs(sum) / times;                 \
+    return lightest::NsToMs(sum) / times;                   \
   }())
 
-/* ========== Assertion Macros ========== */
-
-// REQ assertion
-// Additionally return a bool: true => pass, false => fail
-#define REQ(actual, operator, expected)                                \
-  ([&]() -> bool {                                                     \
-    bool res = (actual) operator(expected);                            \
-    testing.Req(TEST_FILE_NAME, __LINE__, actual, expected, #operator, \
-                #actual " " #operator" " #expected, !res);             \
-    return res;                                                        \
-  })()
-
-// Condition must be true or stop currnet test
-#define MUST(condition) \
-  do {                  \
-    if (!(condition)) { \
-      return;           \
-    }                   \
-  } while (0)
-
 #undef _LINUX_
 #undef _WIN_
 #undef _MAC_
+#undef _TSC_
+#undef _NOINLINE_
 
 #endif
@@ -0,0 +1,321 @@
+/*
+This is the slim header of Lightest, which only declares what TESTs, SUBs and
+REQs need, with few standard headers, so that lots of test files parse fast.
+The rest is compiled once in the library, so link lightest::library to use it.
+Include lightest.h instead for CONFIG, DATA, listeners and extensions.
+Without LIGHTEST_LIBRARY, it includes lightest.h for a single-file program.
+*/
+
+// Nothing of a single-file program is defined without lightest.h, which
+// includes this header in turn
+#if !defined(LIGHTEST_LIBRARY) && !defined(_LIGHTEST_H_)
+#include "lightest.h"
+#endif
+
+#ifndef _LIGHTEST_LITE_H_
+#define _LIGHTEST_LITE_H_
+
+#include <cstddef>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// By default, a test program is a single file, and functions & global
+// variables of Lightest are defined in lightest.h. With LIGHTEST_LIBRARY
+// defined (e.g. by linking lightest::library), the headers only declare the
+// global variables & main, which are defined in one file defining
+// LIGHTEST_IMPLEMENTATION, so that test files can be linked into one program
+// Functions are inline to be defined in every file
+#if !defined(LIGHTEST_LIBRARY) || defined(LIGHTEST_IMPLEMENTATION)
+#define _LIGHTEST_DEFINITIONS_
+#endif
+#ifdef _LIGHTEST_DEFINITIONS_
+#define LIGHTEST_EXTERN
+#define LIGHTEST_INIT(...) __VA_ARGS__
+#else
+#define LIGHTEST_EXTERN extern
+#define LIGHTEST_INIT(...)
+#endif
+
+// Parameters pre-defined by macros for their bodies, e.g. testing of TESTs,
+// may be left unused by the bodies
+#ifdef __GNUC__
+#define _MAYBE_UNUSED_ __attribute__((unused))
+#else
+#define _MAYBE_UNUSED_
+#endif
+
+namespace lightest {
+using namespace std;
+
+class DataSet;
+class Listener;
+class Testing;
+
+/* ========== Registering ========== */
+
+typedef struct {
+  DataSet* testData;
+  int argn;
+  char** argc;
+  size_t index;  // Of the callback in its register
+} RegisterContext;
+
+class Registering;
+
+// Registered CONFIGs, TESTs or DATAs linked in registration order
+// Zero initialized before any registering, for it needs no constructor
+typedef struct {
+  Registering* head;
+  Registering** tail;  // Where to link the next one, nullptr for &head
+  size_t size;
+} RegisterList;
+
+// Registering a CONFIG, TEST or DATA links a node to a list by the constructor
+// of the node, run in dynamic initialization of the file defining it, which
+// only takes a few stores without allocation or std::function
+class Registering {
+ public:
+  Registering(RegisterList& list, const char* name,
+              void (*callerFunc)(RegisterContext&))
+      : name(name), callerFunc(callerFunc), next(nullptr) {
+    *(list.tail == nullptr ? &list.head : list.tail) = this;
+    list.tail = &next;
+    list.size++;
+  }
+  inline Registering(Listener* listener);
+
+ private:
+  friend class Register;
+  const char* name;
+  void (*callerFunc)(RegisterContext&);
+  Registering* next;
+};
+
+// CONFIGs, TESTs & DATAs link themselves to the lists, which are ready even
+// if files registering them are initialized before the one defining them
+LIGHTEST_EXTERN RegisterList configList, testList, dataList;
+
+/* ========== Running ========== */
+
+// Run a TEST, collecting its data
+void RunTest(RegisterContext& ctx, const char* name, const char* file,
+             unsigned int line, void (*func)(Testing&));
+
+// Body of a SUB, whose lambda is called through plain function pointers, so
+// that no std::function is built for it
+typedef struct {
+  void (*call)(void* lambda, Testing& testing);
+  void (*destroy)(void* lambda);
+  void* lambda;
+  const Testing* parent;
+  const char* file;
+  unsigned int line;
+} SubBody;
+
+// Add a SUB to its parent, to be run after the parent's body
+void AddSub(Testing& testing, const char* name, const SubBody& body);
+
+// Adds the lambda assigned to it as a SUB, see SUB(name)
+class SubDefining {
+ public:
+  SubDefining(Testing& testing, const char* name, const char* file,
+              unsigned int line)
+      : testing(testing), name(name), file(file), line(line) {}
+  template <typename Func>
+  void operator=(const Func& func) {
+    AddSub(testing, name,
+           SubBody{Call<Func>, Destroy<Func>, new Func(func), &testing, file,
+                   line});
+  }
+
+ private:
+  template <typename Func>
+  static void Call(void* lambda, Testing& testing) {
+    (*static_cast<Func*>(lambda))(testing);
+  }
+  template <typename Func>
+  static void Destroy(void* lambda) {
+    delete static_cast<Func*>(lambda);
+  }
+  Testing& testing;
+  const char* name;
+  const char* file;
+  unsigned int line;
+};
+
+/* ========== REQ ========== */
+
+// Max length of strings of REQ operands, use MAX_OPERAND_LENGTH(n) to set
+LIGHTEST_EXTERN size_t maxOperandLength LIGHTEST_INIT(= 256);
+
+// A stream buffer only keeping the first maxOperandLength chars
+// It refuses chars beyond the limit so that the stream fails, and the rest of
+// an operator<< on e.g. a huge container stops writing
+class OperandBuf : public streambuf {
+ public:
+  OperandBuf() : cut(false) {}
+  string str;
+  bool cut;
+
+ protected:
+  int_type overflow(int_type ch) {
+    if (traits_type::eq_int_type(ch, traits_type::eof())) return ch;
+    if (str.size() >= maxOperandLength) {
+      cut = true;
+      return traits_type::eof();
+    }
+    str += traits_type::to_char_type(ch);
+    return ch;
+  }
+  streamsize xsputn(const char* s, streamsize n) {
+    size_t room = maxOperandLength - str.size();
+    if (size_t(n) > room) {
+      str.append(s, room);
+      cut = true;
+      return streamsize(room);
+    }
+    str.append(s, size_t(n));
+    return n;
+  }
+};
+
+// Whether a type can be written to an ostream
+template <typename T>
+class IsPrintable {
+  template <typename V>
+  static auto Test(int)
+      -> decltype(declval<ostream&>() << declval<const V&>(), true_type());
+  template <typename>
+  static false_type Test(...);
+
+ public:
+  static const bool value = decltype(Test<T>(0))::value;
+};
+
+template <typename T>
+typename enable_if<IsPrintable<T>::value>::type PrintOperand(ostream& os,
+                                                             const T& value) {
+  os << value;
+}
+template <typename T>
+typename enable_if<!IsPrintable<T>::value>::type PrintOperand(ostream& os,
+                                                              const T&) {
+  os << "{unprintable}";
+}
+
+// Copy a string to the thread's arena, to live as long as test data
+const char* CopyToArena(const char* source);
+
+// Render an operand of a failed REQ to a string stored in the thread's arena
+template <typename T>
+const char* OperandToString(const T& value) {
+  OperandBuf buf;
+  ostream os(&buf);
+  PrintOperand(os, value);
+  if (buf.cut) buf.str += "...";
+  return CopyToArena(buf.str.c_str());
+}
+
+// Result of comparing operands of a REQ, which refers to them without copying
+template <typename T, typename U>
+struct ReqResult {
+  bool passed;
+  const T& actual;
+  const U& expected;
+};
+
+// REQ compares ReqLeft{actual} with expected, so that only these small
+// operators are instantiated for each pair of operand types
+template <typename T>
+struct ReqLeft {
+  const T& actual;
+};
+template <typename T>
+ReqLeft<T> MakeReqLeft(const T& actual) {
+  return ReqLeft<T>{actual};
+}
+#define _REQ_OPERATOR_(op)                                                 \
+  template <typename T, typename U>                                        \
+  ReqResult<T, U> operator op(const ReqLeft<T>& left, const U& expected) { \
+    return ReqResult<T, U>{static_cast<bool>(left.actual op expected),     \
+                           left.actual, expected};                         \
+  }
+_REQ_OPERATOR_(==)
+_REQ_OPERATOR_(!=)
+_REQ_OPERATOR_(<)
+_REQ_OPERATOR_(<=)
+_REQ_OPERATOR_(>)
+_REQ_OPERATOR_(>=)
+#undef _REQ_OPERATOR_
+
+void ReqPassed(Testing& testing, const char* file, unsigned int line,
+               const char* operator_, const char* expr);
+void ReqFailed(Testing& testing, const char* file, unsigned int line,
+               const char* actual, const char* expected,
+               const char* operator_, const char* expr);
+
+// Record a REQ, returning whether it passes
+// Only rendering operands of failed ones depends on their types
+template <typename T, typename U>  // Differnt type for e.g. <int> == <double>
+bool Req(Testing& testing, const char* file, unsigned int line,
+         const char* operator_, const char* expr,
+         const ReqResult<T, U>& result) {
+  if (result.passed) {
+    ReqPassed(testing, file, line, operator_, expr);
+  } else {
+    ReqFailed(testing, file, line, OperandToString(result.actual),
+              OperandToString(result.expected), operator_, expr);
+  }
+  return result.passed;
+}
+
+};  // namespace lightest
+
+/* ========== Macros ========== */
+
+// Avoid undef or redefine buildin macro warning
+// Undef and then define again to have prettier file name
+#ifndef TEST_FILE_NAME
+#ifdef __FILE_NAME__
+#define TEST_FILE_NAME __FILE_NAME__
+#else
+#define TEST_FILE_NAME __FILE__
+#endif
+#endif
+
+// To define a test
+#define TEST(name)                                                 \
+  void name(lightest::Testing& testing);                           \
+  void call_##name(lightest::RegisterContext& ctx) {               \
+    lightest::RunTest(ctx, #name, TEST_FILE_NAME, __LINE__, name); \
+  }                                                                \
+  lightest::Registering registering_##name(lightest::testList,     \
+                                           #name, call_##name);    \
+  void name(lightest::Testing& testing _MAYBE_UNUSED_)
+
+#define SUB(name)                                                      \
+  lightest::SubDefining name(testing, #name, TEST_FILE_NAME, __LINE__); \
+  name = [=](lightest::Testing & testing _MAYBE_UNUSED_)
+
+/* ========== Assertion Macros ========== */
+
+// REQ assertion, whose operator is one of ==, !=, <, <=, > and >=
+// Additionally return a bool: true => pass, false => fail
+// Operands are evaluated once and compared in place without copying
+#define REQ(actual, operator, expected)                       \
+  lightest::Req(testing, TEST_FILE_NAME, __LINE__, #operator, \
+                #actual " " #operator " " #expected,          \
+                lightest::MakeReqLeft(actual) operator(expected))
+
+// Condition must be true or stop currnet test
+#define MUST(condition) \
+  do {                  \
+    if (!(condition)) { \
+      return;           \
+    }                   \
+  } while (0)
+
+#endif
@@ -0,0 +1,342 @@
+/*
+This is a Lightest extension, which runs TESTs on a pool of threads by
+PARALLEL(n), and also their SUBs by PARALLEL_SUB(). Test files without it
+needn't parse the headers of threads.
+*/
+
+#ifndef _PARALLEL_EXT_H_
+#define _PARALLEL_EXT_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <thread>
+#include "lightest.h"
+
+namespace lightest {
+
+/* ========== Thread Pool ========== */
+
+// Use PARALLEL(n) to run tests on n threads
+LIGHTEST_EXTERN unsigned int jobs LIGHTEST_INIT(= 1);
+// Limit of jobs given by flags, for more threads only come from typos
+const unsigned int maxJobs = 4096;
+
+// A work-stealing thread pool for running tests parallelly
+// Every thread owns a task queue. It pops tasks from the back of its own
+// queue, and steals tasks from the front of others' when its own is empty.
+// A thread waiting for a batch of tasks helps running tasks of the batch
+// instead of blocking, so nested tasks (e.g. SUBs of a TEST running on the
+// pool) never dead lock. It never runs tasks of other batches, which would
+// nest unrelated tests in the waiting one, adding to its time
+class ThreadPool {
+ public:
+  // Tasks pushed together, and waited for together
+  class Batch {
+   public:
+    Batch() : remaining(0), queued(0) {}
+
+   private:
+    friend class ThreadPool;
+    atomic<size_t> remaining;  // Count of unfinished tasks
+    atomic<size_t> queued;     // Count of tasks not taken yet
+  };
+  // The thread creating the pool is counted as one of the threadsNum threads
+  ThreadPool(unsigned int threadsNum) : queuedNum(0), stop(false) {
+    for (unsigned int i = 0; i < threadsNum; i++) {
+      queues.push_back(new TaskQueue);
+    }
+    for (unsigned int i = 1; i < threadsNum; i++) {
+      workers.push_back(thread(&ThreadPool::Work, this, i));
+    }
+  }
+  // Run all the tasks on the pool and wait until all of them finish
+  void RunAll(const vector<function<void()>>& funcs) {
+    Batch batch;
+    Push(funcs, batch);
+    Wait(batch);
+  }
+  // Queue tasks to the batch without waiting
+  void Push(const vector<function<void()>>& funcs, Batch& batch) {
+    batch.remaining += funcs.size();
+    batch.queued += funcs.size();
+    TaskQueue* queue = queues[workerIndex];
+    queuedNum += funcs.size();
+    {
+      lock_guard<mutex> guard(queue->lock);
+      // Push reversely, for the owner pops from the back
+      for (size_t i = funcs.size(); i > 0; i--) {
+        queue->tasks.push_back(Task{&funcs[i - 1], &batch});
+      }
+    }
+    Notify();
+  }
+  // Help running tasks of the batch until all of them finish
+  void Wait(Batch& batch) {
+    while (batch.remaining > 0) {
+      Task task;
+      if (TakeTask(task, &batch)) {
+        RunTask(task);
+        continue;
+      }
+      unique_lock<mutex> guard(sleepLock);
+      wake.wait(guard, [&batch]() {
+        return batch.remaining == 0 || batch.queued > 0;
+      });
+    }
+  }
+  ~ThreadPool() {
+    {
+      lock_guard<mutex> guard(sleepLock);
+      stop = true;
+    }
+    wake.notify_all();
+    for (thread& worker : workers) {
+      worker.join();
+    }
+    for (TaskQueue* queue : queues) {
+      delete queue;
+    }
+  }
+
+ private:
+  typedef struct {
+    const function<void()>* func;
+    Batch* batch;
+  } Task;
+  typedef struct {
+    mutex lock;
+    deque<Task> tasks;
+  } TaskQueue;
+  void Work(unsigned int index) {
+    workerIndex = index;
+    while (true) {
+      Task task;
+      if (TakeTask(task, nullptr)) {
+        RunTask(task);
+        continue;
+      }
+      unique_lock<mutex> guard(sleepLock);
+      wake.wait(guard, [this]() { return stop || queuedNum > 0; });
+      if (stop) return;
+    }
+  }
+  // Take a task of the batch, or of any batch if it's nullptr
+  bool TakeTask(Task& task, const Batch* batch) {
+    for (size_t i = 0; i < queues.size(); i++) {
+      TaskQueue* queue = queues[(workerIndex + i) % queues.size()];
+      lock_guard<mutex> guard(queue->lock);
+      deque<Task>& tasks = queue->tasks;
+      size_t j;
+      if (i == 0) {  // Own queue, from the back
+        j = tasks.size();
+        while (j > 0 && batch != nullptr && tasks[j - 1].batch != batch) j--;
+        if (j == 0) continue;
+        j--;
+      } else {  // Steal from the front
+        j = 0;
+        while (j < tasks.size() && batch != nullptr && tasks[j].batch != batch)
+          j++;
+        if (j == tasks.size()) continue;
+      }
+      task = tasks[j];
+      tasks.erase(tasks.begin() + j);
+      queuedNum--;
+      task.batch->queued--;
+      return true;
+    }
+    return false;
+  }
+  void RunTask(const Task& task) {
+    (*task.func)();
+    if (--task.batch->remaining == 0) Notify();
+  }
+  void Notify() {
+    // Lock once to avoid losing wake-ups of threads going to wait
+    { lock_guard<mutex> guard(sleepLock); }
+    wake.notify_all();
+  }
+  vector<TaskQueue*> queues;
+  vector<thread> workers;
+  atomic<size_t> queuedNum;
+  bool stop;
+  mutex sleepLock;
+  condition_variable wake;
+  static thread_local unsigned int workerIndex;  // 0 for the creating thread
+};
+#ifdef _LIGHTEST_DEFINITIONS_
+thread_local unsigned int ThreadPool::workerIndex = 0;
+#endif
+
+// Only exists while running tests
+LIGHTEST_EXTERN ThreadPool* threadPool;
+
+/* ========== Running TESTs ========== */
+
+// TESTs of the run, claimed one by one by the threads running them
+// Data of each TEST are collected apart, and merged in registration order to
+// keep outputs deterministic. A hung TEST is reported as timed out, and a new
+// thread takes over the work of the thread running it, so the run moves on
+class TestsRun {
+ public:
+  TestsRun(Register& reg_)
+      : reg(reg_),
+        next(0),
+        finishedNum(0),
+        abandoned(false),
+        endingThread(ThreadTag()) {
+    for (size_t i = 0; i < reg.GetRegisteredNum(); i++) {
+      DataSet* collector = new DataSet("");
+      collector->SetTabs(reg.testData->GetTabs());
+      collectors.push_back(collector);
+    }
+    finished.assign(collectors.size(), false);
+  }
+  // Run all the TESTs, parallelly if a thread pool is given
+  void Run(ThreadPool* pool) {
+    if (pool != nullptr && collectors.size() > 1) {
+      runners.assign(min(size_t(jobs), collectors.size()) - 1,
+                     [this]() { RunClaimed(); });
+      pool->Push(runners, runnersBatch);
+    }
+    RunClaimed();
+    WaitTests();
+    // Threads of hung TESTs never end
+    if (pool != nullptr && !Abandoned()) pool->Wait(runnersBatch);
+    Merge();
+  }
+  // Whether threads of hung TESTs are left running, so that the run must end
+  // without cleaning up
+  bool Abandoned() const { return abandoned; }
+  // Report a hung TEST settled by the caller with its data, and take over the
+  // work of its thread
+  void Abandon(const Testing& test, DataSet* data) {
+    lock_guard<mutex> guard(lock);
+    size_t index = test.GetIndex();
+    if (!finished[index]) {
+      collectors[index]->Add(data);
+      NotifyTestData(data);
+      Finished(index);
+    }
+    abandoned = true;
+    // The taker tags itself as the ending thread, before running any TEST
+    // which may be abandoned in turn
+    thread taker(&TestsRun::TakeOver, this,
+                 test.GetRunner() == endingThread);
+    taker.detach();
+  }
+
+ private:
+  void RunClaimed() {
+    for (size_t index; (index = next++) < collectors.size();) {
+      reg.RunOne(index, collectors[index]);
+      lock_guard<mutex> guard(lock);
+      Finished(index);
+    }
+  }
+  void Finished(size_t index) {
+    finished[index] = true;
+    if (++finishedNum == collectors.size()) allFinished.notify_all();
+  }
+  void WaitTests() {
+    unique_lock<mutex> guard(lock);
+    allFinished.wait(guard,
+                     [this]() { return finishedNum == collectors.size(); });
+  }
+  void Merge() {
+    for (DataSet* collector : collectors) {
+      collector->MoveSons(reg.testData);
+      delete collector;
+    }
+  }
+  // Run the rest of the TESTs, and also end the run if the thread taken over
+  // was going to
+  void TakeOver(bool endsRun) {
+    if (endsRun) {
+      lock_guard<mutex> guard(lock);
+      endingThread = ThreadTag();
+    }
+    RunClaimed();
+    if (!endsRun) return;
+    WaitTests();
+    Merge();
+    FastExit(EndRun());
+  }
+  Register& reg;
+  vector<DataSet*> collectors;
+  vector<bool> finished;
+  vector<function<void()>> runners;  // Tasks on the pool running TESTs
+  atomic<size_t> next;               // Index of the next TEST to claim
+  size_t finishedNum;
+  ThreadPool::Batch runnersBatch;
+  atomic<bool> abandoned;  // Set by the watchdog thread
+  const void* endingThread;  // The main thread, or the one taking it over
+  mutex lock;
+  condition_variable allFinished;
+};
+
+// Only exists while running TESTs
+LIGHTEST_EXTERN TestsRun* testsRun;
+
+// Resolve PARALLEL(0) to as many jobs as hardware threads
+inline unsigned int ResolveJobs() {
+  if (jobs == 0) jobs = thread::hardware_concurrency();
+  return jobs;
+}
+
+// Run TESTs on the threads of PARALLEL(n), taking over the in-process runner
+// of the core, also for timeout_ext.h to move on from hung TESTs
+inline void RunTests(Register& reg) {
+  if (ResolveJobs() > 1) threadPool = new ThreadPool(jobs);
+  TestsRun run(reg);
+  testsRun = &run;
+  run.Run(threadPool);
+  testsRun = nullptr;
+  // Threads of hung TESTs can't be joined, nor can their data be released
+  if (run.Abandoned()) FastExit(EndRun());
+  delete threadPool;
+  threadPool = nullptr;
+}
+
+// Run SUBs of a test on the pool, each collecting its data into its own
+// DataSet, merged in registration order under the lock if given to keep
+// outputs deterministic
+inline void RunSubsParallelly(Register& reg, mutex* dataLock) {
+  if (threadPool == nullptr || reg.GetRegisteredNum() <= 1) {
+    reg.RunRegistered();
+    return;
+  }
+  vector<DataSet*> collectors;
+  vector<function<void()>> tasks;
+  for (size_t i = 0; i < reg.GetRegisteredNum(); i++) {
+    DataSet* collector = new DataSet("");
+    collector->SetTabs(reg.testData->GetTabs());
+    collectors.push_back(collector);
+    tasks.push_back([&reg, i, collector]() { reg.RunOne(i, collector); });
+  }
+  threadPool->RunAll(tasks);
+  unique_lock<mutex> guard = dataLock != nullptr
+                                 ? unique_lock<mutex>(*dataLock)
+                                 : unique_lock<mutex>();
+  for (DataSet* collector : collectors) {
+    collector->MoveSons(reg.testData);
+    delete collector;
+  }
+}
+
+// Takes over the in-process runner during static initialization
+class ParallelRunning {
+ public:
+  ParallelRunning() { inProcessRunner = RunTests; }
+};
+LIGHTEST_EXTERN ParallelRunning parallelRunning;
+
+};  // namespace lightest
+
+// Run tests on n threads (0 => as many as hardware threads)
+#define PARALLEL(n) lightest::jobs = (n);
+// Also run SUBs parallelly when PARALLEL(n) is set
+#define PARALLEL_SUB() lightest::subsRunner = lightest::RunSubsParallelly;
+
+#endif
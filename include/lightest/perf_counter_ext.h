@@ -0,0 +1,279 @@
+/*
+This is a Lightest extension, which records hardware performance counters
+(cycles, instructions, cache misses, and branch misses) of every test by
+perf_event_open on Linux. Where the counters are unavailable, e.g. in some
+containers or on other platforms, only timing is recorded as usual.
+lightest::library includes it on Linux, where counters are only recorded with
+PERF_COUNTERS() or --perf-counters.
+*/
+
+#ifndef _PERF_COUNTER_EXT_H_
+#define _PERF_COUNTER_EXT_H_
+
+#include "data_analysis_ext.h"
+#include "lightest.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace lightest {
+
+enum PerfCounter {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_CACHE_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_COUNTERS_NUM
+};
+
+const char* const perfCounterNames[PERF_COUNTERS_NUM] = {
+    "cycles", "instructions", "cache-misses", "branch-misses"};
+
+/* ========== Counters ========== */
+
+// Counters of the current thread, opened once as a group so that all of them
+// are read by one read call
+class PerfCounterGroup {
+ public:
+  PerfCounterGroup() : leader(-1), openedNum(0) {
+#ifdef __linux__
+    const unsigned long long configs[PERF_COUNTERS_NUM] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    for (int i = 0; i < PERF_COUNTERS_NUM; i++) {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[i];
+      // Times enabled & running tell how long the group was multiplexed out
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+      attr.disabled = leader == -1;  // Enable the group by its leader
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+      // Counters not supported are skipped
+      if (fd == -1) continue;
+      if (leader == -1) leader = fd;
+      fds[openedNum] = fd, counters[openedNum] = PerfCounter(i);
+      openedNum++;
+    }
+    if (leader != -1) ioctl(leader, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+  }
+  bool Available() const { return openedNum > 0; }
+  // Read values in order of PerfCounter, the availability of each, and the
+  // times (ns) the group has been enabled & running on the CPU
+  bool Read(unsigned long long values[PERF_COUNTERS_NUM],
+            bool has[PERF_COUNTERS_NUM], unsigned long long& enabled,
+            unsigned long long& running) const {
+    for (int i = 0; i < PERF_COUNTERS_NUM; i++) has[i] = false;
+#ifdef __linux__
+    // nr, time enabled, time running, values...
+    unsigned long long buffer[3 + PERF_COUNTERS_NUM];
+    if (leader == -1 || read(leader, buffer, sizeof(buffer)) <= 0) {
+      return false;
+    }
+    enabled = buffer[1], running = buffer[2];
+    for (unsigned long long i = 0; i < buffer[0] && i < openedNum; i++) {
+      values[counters[i]] = buffer[3 + i], has[counters[i]] = true;
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+  ~PerfCounterGroup() {
+#ifdef __linux__
+    for (unsigned int i = 0; i < openedNum; i++) close(fds[i]);
+#endif
+  }
+
+ private:
+  int leader;
+  int fds[PERF_COUNTERS_NUM];
+  PerfCounter counters[PERF_COUNTERS_NUM];  // Counter of each opened fd
+  unsigned int openedNum;
+};
+
+inline PerfCounterGroup& ThreadPerfCounters() {
+  static thread_local PerfCounterGroup group;
+  return group;
+}
+
+/* ========== Data ========== */
+
+// Data class of performance counters of a test, including its sub tests
+class DataPerfCounters : public Data {
+ public:
+  DataPerfCounters(const unsigned long long values_[PERF_COUNTERS_NUM],
+                   const bool has_[PERF_COUNTERS_NUM]) {
+    for (int i = 0; i < PERF_COUNTERS_NUM; i++) {
+      values[i] = values_[i], has[i] = has_[i];
+    }
+  }
+  void Print() const {
+    PrintTabs();
+    PRINT_LABEL(Color::Blue, " PERF  ");
+    PrintValues();
+    Output() << '\n';
+  }
+  DataType Type() const { return DATA_PERF_COUNTERS; }
+  const bool GetFailed() const { return false; }
+  bool Has(PerfCounter counter) const { return has[counter]; }
+  unsigned long long Get(PerfCounter counter) const { return values[counter]; }
+  // Output counters available & IPC, e.g. " 100 cycles, 200 instructions"
+  void PrintValues() const {
+    const char* separator = " ";
+    for (int i = 0; i < PERF_COUNTERS_NUM; i++) {
+      if (!has[i]) continue;
+      Output() << separator << values[i] << " " << perfCounterNames[i];
+      separator = ", ";
+    }
+    if (has[PERF_CYCLES] && has[PERF_INSTRUCTIONS] && values[PERF_CYCLES] > 0) {
+      Output() << ", IPC "
+               << double(values[PERF_INSTRUCTIONS]) / values[PERF_CYCLES];
+    }
+  }
+
+ private:
+  unsigned long long values[PERF_COUNTERS_NUM];
+  bool has[PERF_COUNTERS_NUM];
+};
+
+// Codec to send counters between processes, e.g. from isolated workers
+inline void EncodePerfCounters(const Data* data, Encoder& encoder) {
+  const DataPerfCounters* counters = static_cast<const DataPerfCounters*>(data);
+  for (int i = 0; i < PERF_COUNTERS_NUM; i++) {
+    encoder.Put<unsigned long long>(counters->Get(PerfCounter(i)));
+    encoder.Put<bool>(counters->Has(PerfCounter(i)));
+  }
+}
+inline Data* DecodePerfCounters(Decoder& decoder) {
+  unsigned long long values[PERF_COUNTERS_NUM];
+  bool has[PERF_COUNTERS_NUM];
+  for (int i = 0; i < PERF_COUNTERS_NUM; i++) {
+    values[i] = decoder.Get<unsigned long long>();
+    has[i] = decoder.Get<bool>();
+  }
+  return new DataPerfCounters(values, has);
+}
+LIGHTEST_EXTERN CodecRegistering perfCountersCodec LIGHTEST_INIT(
+    (DATA_PERF_COUNTERS, DataCodec{EncodePerfCounters, DecodePerfCounters}));
+
+// Get counters of a test, nullptr if unavailable
+inline const DataPerfCounters* GetPerfCounters(const DataSet* data) {
+  const DataPerfCounters* counters = nullptr;
+  data->IterSons([&counters](const Data* item) {
+    if (item->Type() == DATA_PERF_COUNTERS) {
+      counters = static_cast<const DataPerfCounters*>(item);
+    }
+  });
+  return counters;
+}
+
+/* ========== Listener ========== */
+
+// Read counters when a test begins and ends, and record the differences
+class PerfCounterListener : public Listener {
+ public:
+  void OnTestBegin(Testing&) {
+    Snapshot snapshot;
+    snapshot.valid = ThreadPerfCounters().Read(
+        snapshot.values, snapshot.has, snapshot.enabled, snapshot.running);
+    Stack().push_back(snapshot);
+  }
+  void OnTestEnd(Testing& testing) {
+    Snapshot begin = Stack().back();
+    Stack().pop_back();
+    Snapshot end;
+    end.valid = ThreadPerfCounters().Read(end.values, end.has, end.enabled,
+                                          end.running);
+    if (!begin.valid || !end.valid) return;
+    // When other events take the counters meanwhile, the group only counts
+    // while running, so its counts are scaled up to the time enabled as
+    // perf does, and are unavailable if it never ran
+    unsigned long long enabled = end.enabled - begin.enabled;
+    unsigned long long running = end.running - begin.running;
+    if (running == 0 && enabled > 0) return;
+    for (int i = 0; i < PERF_COUNTERS_NUM; i++) {
+      end.has[i] = begin.has[i] && end.has[i];
+      end.values[i] = end.has[i] ? end.values[i] - begin.values[i] : 0;
+      if (running < enabled) {
+        end.values[i] = (unsigned long long)(double(end.values[i]) * enabled /
+                                             running);
+      }
+    }
+    testing.AddData(new DataPerfCounters(end.values, end.has));
+  }
+
+ private:
+  typedef struct {
+    bool valid;
+    unsigned long long values[PERF_COUNTERS_NUM];
+    bool has[PERF_COUNTERS_NUM];
+    unsigned long long enabled, running;
+  } Snapshot;
+  // Snapshots of nested tests running on the current thread
+  static vector<Snapshot>& Stack() {
+    static thread_local vector<Snapshot> stack;
+    return stack;
+  }
+};
+LIGHTEST_EXTERN PerfCounterListener perfCounterListener;
+// Counters of all the tests are recorded once the extension is included in a
+// single-file program. The library includes it for everyone, so counters are
+// only recorded when asked for there
+#if defined(_LIGHTEST_DEFINITIONS_) && !defined(LIGHTEST_LIBRARY)
+Registering perfCounterListening(&perfCounterListener);
+#endif
+
+// Record counters of all the tests, if they aren't recorded yet
+inline void RecordPerfCounters() {
+  for (Listener* listener : Listeners()) {
+    if (listener == &perfCounterListener) return;
+  }
+  AddListener(&perfCounterListener);
+}
+
+// Commandline flags for ARG_CONFIG(), which is only --perf-counters
+inline void MatchPerfCounterFlag(const string&, const char*) {
+  RecordPerfCounters();
+}
+LIGHTEST_EXTERN FlagRegistering perfCounterFlags
+    LIGHTEST_INIT(("--perf-counters", MatchPerfCounterFlag));
+
+};  // namespace lightest
+
+/* ========== Configuration Macros ========== */
+
+// Record performance counters of all the tests, e.g. with lightest::library
+#define PERF_COUNTERS() lightest::RecordPerfCounters();
+
+/* ========== Reporting Macros ========== */
+
+// Report performance counters of all the tests (recursively including sub
+// tests)
+#define REPORT_PERF_COUNTERS()                                       \
+  do {                                                               \
+    lightest::Output() << "Performance counters:\n";                 \
+    if (!lightest::ThreadPerfCounters().Available()) {               \
+      lightest::Output() << " Unavailable\n";                        \
+      break;                                                         \
+    }                                                                \
+    lightest::IterAllTests(data, [](const lightest::DataSet* item) { \
+      const lightest::DataPerfCounters* counters =                   \
+          lightest::GetPerfCounters(item);                           \
+      if (counters == nullptr) return;                               \
+      item->PrintTabs() << " * " << item->GetName() << ":";          \
+      counters->PrintValues();                                       \
+      lightest::Output() << '\n';                                    \
+    });                                                              \
+  } while (0)
+
+#endif
@@ -0,0 +1,262 @@
+/*
+This is a Lightest extension, which writes reports of tests in JUnit XML, JSON
+Lines, or TAP for CI systems. Reports are written through buffered sinks as
+each TEST ends, so the memory used doesn't grow with the run, and no pass over
+the whole data tree is needed at the end.
+*/
+
+#ifndef _REPORT_EXT_H_
+#define _REPORT_EXT_H_
+
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include "lightest.h"
+
+namespace lightest {
+
+/* ========== Failures ========== */
+
+// Collect failures of test actions directly in a test, skipping sub tests
+// Each type of data describes its failures by Data::GetFailure()
+inline vector<Failure> GetFailures(const DataSet* test) {
+  vector<Failure> failures;
+  test->IterSons([&failures](const Data* item) {
+    // Sub tests are reported as tests themselves
+    if (!item->GetFailed() || item->Type() == DATA_SET) return;
+    failures.push_back(item->GetFailure());
+  });
+  return failures;
+}
+
+/* ========== Reporters ========== */
+
+// Base of reporters, which writes a report of every TEST and its SUBs when
+// its data are added to the results of the run
+class Reporter : public Listener {
+ public:
+  Reporter() : testsNum(0), failedNum(0), out(nullptr) {}
+  void Open(const string& fileName) {
+    if (out.rdbuf() != nullptr) return;  // Only one report of a format
+    // Never deleted, so that forked workers exiting won't flush their copies
+    // of the buffer to the file
+    ofstream* file = new ofstream(fileName);
+    if (!file->is_open()) {
+      cerr << "lightest: cannot open " << fileName << endl;
+      exit(1);
+    }
+    sink = new StreamSink(*file);
+    out.rdbuf(sink);
+    out.precision(6);
+    AddListener(this);
+    Begin();
+    sink->Flush();
+  }
+  void OnTestData(const DataSet* data) {
+    lock_guard<mutex> lock(reportLock);
+    Report(data, data->GetName());
+  }
+  void OnRunEnd(const DataSet*) {
+    lock_guard<mutex> lock(reportLock);
+    End();
+    sink->Flush();
+  }
+  virtual ~Reporter() {}
+
+ protected:
+  virtual void Begin() = 0;
+  // Write the report of a test, path being names of it and its parents
+  virtual void Test(const DataSet* test, const string& path) = 0;
+  virtual void End() = 0;
+  unsigned int testsNum, failedNum;
+  ostream out;
+
+ private:
+  void Report(const DataSet* test, const string& path) {
+    testsNum++;
+    if (test->GetFailed()) failedNum++;
+    Test(test, path);
+    test->IterSons([this, &path](const Data* item) {
+      if (item->Type() != DATA_SET) return;
+      const DataSet* sub = static_cast<const DataSet*>(item);
+      Report(sub, path + "/" + sub->GetName());
+    });
+  }
+  OutputSink* sink;
+  mutex reportLock;
+};
+
+// Escape &, <, >, " and control chars for XML attributes & texts, keeping
+// line breaks in attributes
+inline string XmlEscape(const string& str) {
+  string escaped;
+  escaped.reserve(str.size());
+  for (char ch : str) {
+    switch (ch) {
+      case '&':
+        escaped += "&amp;";
+        break;
+      case '<':
+        escaped += "&lt;";
+        break;
+      case '>':
+        escaped += "&gt;";
+        break;
+      case '"':
+        escaped += "&quot;";
+        break;
+      case '\n':
+        escaped += "&#10;";
+        break;
+      default:
+        if ((unsigned char)ch < 0x20 && ch != '\t') {
+          escaped += ' ';  // Not allowed in XML 1.0
+        } else {
+          escaped += ch;
+        }
+    }
+  }
+  return escaped;
+}
+
+// Escape a string into a JSON string literal with the quotes
+inline string JsonString(const string& str) {
+  string escaped = "\"";
+  for (char ch : str) {
+    switch (ch) {
+      case '"':
+        escaped += "\\\"";
+        break;
+      case '\\':
+        escaped += "\\\\";
+        break;
+      case '\n':
+        escaped += "\\n";
+        break;
+      case '\t':
+        escaped += "\\t";
+        break;
+      default:
+        if ((unsigned char)ch < 0x20) {
+          char code[7];
+          snprintf(code, sizeof(code), "\\u%04x", (unsigned int)ch);
+          escaped += code;
+        } else {
+          escaped += ch;
+        }
+    }
+  }
+  return escaped + "\"";
+}
+
+// A <testcase> for every TEST and SUB, named by its path
+// Totals are left out of <testsuite>, which would need a second pass
+class JUnitReporter : public Reporter {
+ protected:
+  void Begin() {
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        << "<testsuites>\n<testsuite name=\"lightest\">\n";
+  }
+  void Test(const DataSet* test, const string& path) {
+    out << "<testcase classname=\"lightest\" name=\"" << XmlEscape(path)
+        << "\" time=\"" << test->GetDuration() / 1000 << "\"";
+    vector<Failure> failures = GetFailures(test);
+    if (failures.empty()) {
+      out << "/>\n";
+      return;
+    }
+    out << ">\n";
+    for (const Failure& failure : failures) {
+      // Uncaught errors & crashes aren't failed assertions
+      const string kind = failure.kind;
+      const char* tag =
+          kind == "ERROR" || kind == "CRASH" ? "error" : "failure";
+      out << "<" << tag << " type=\"" << failure.kind << "\" message=\""
+          << XmlEscape(failure.message) << "\">";
+      if (failure.file != nullptr) {
+        out << XmlEscape(failure.file) << ":" << failure.line;
+      }
+      out << "</" << tag << ">\n";
+    }
+    out << "</testcase>\n";
+  }
+  void End() { out << "</testsuite>\n</testsuites>\n"; }
+};
+
+// A JSON object per line for every TEST and SUB, and one for the whole run
+class JsonReporter : public Reporter {
+ protected:
+  void Begin() {}
+  void Test(const DataSet* test, const string& path) {
+    out << "{\"type\":\"test\",\"path\":" << JsonString(path)
+        << ",\"failed\":" << (test->GetFailed() ? "true" : "false")
+        << ",\"duration_ms\":" << test->GetDuration()
+        << ",\"cpu_ms\":" << test->GetCpuDuration()
+        << ",\"reqs\":" << test->GetReqsNum()
+        << ",\"failed_reqs\":" << test->GetFailedReqsNum()
+        << ",\"failures\":[";
+    vector<Failure> failures = GetFailures(test);
+    for (size_t i = 0; i < failures.size(); i++) {
+      if (i > 0) out << ",";
+      out << "{\"kind\":" << JsonString(failures[i].kind)
+          << ",\"message\":" << JsonString(failures[i].message);
+      if (failures[i].file != nullptr) {
+        out << ",\"file\":" << JsonString(failures[i].file)
+            << ",\"line\":" << failures[i].line;
+      }
+      out << "}";
+    }
+    out << "]}\n";
+  }
+  void End() {
+    out << "{\"type\":\"run\",\"tests\":" << testsNum
+        << ",\"failed\":" << failedNum << "}\n";
+  }
+};
+
+// A TAP line for every TEST and SUB, with failures in YAML blocks
+// The plan is at the end, which TAP allows for streaming
+class TapReporter : public Reporter {
+ protected:
+  void Begin() { out << "TAP version 13\n"; }
+  void Test(const DataSet* test, const string& path) {
+    out << (test->GetFailed() ? "not ok " : "ok ") << testsNum << " - "
+        << path << " # time=" << test->GetDuration() << "ms\n";
+    vector<Failure> failures = GetFailures(test);
+    if (failures.empty()) return;
+    out << "  ---\n  failures:\n";
+    for (const Failure& failure : failures) {
+      out << "    - kind: " << failure.kind
+          << "\n      message: " << JsonString(failure.message) << "\n";
+      if (failure.file != nullptr) {
+        out << "      at: "
+            << JsonString(string(failure.file) + ":" +
+                          to_string(failure.line))
+            << "\n";
+      }
+    }
+    out << "  ...\n";
+  }
+  void End() { out << "1.." << testsNum << "\n"; }
+};
+
+LIGHTEST_EXTERN JUnitReporter junitReporter;
+LIGHTEST_EXTERN JsonReporter jsonReporter;
+LIGHTEST_EXTERN TapReporter tapReporter;
+
+// Commandline flags for ARG_CONFIG()
+inline void MatchReportFlag(const string& flag, const char* value) {
+  if (flag == "--junit") junitReporter.Open(value);
+  if (flag == "--json") jsonReporter.Open(value);
+  if (flag == "--tap") tapReporter.Open(value);
+}
+LIGHTEST_EXTERN FlagRegistering reportFlags
+    LIGHTEST_INIT(("--junit= --json= --tap=", MatchReportFlag));
+
+};  // namespace lightest
+
+#define REPORT_JUNIT(file) lightest::junitReporter.Open(file);
+#define REPORT_JSON(file) lightest::jsonReporter.Open(file);
+#define REPORT_TAP(file) lightest::tapReporter.Open(file);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+This is a Lightest extension, which splits TESTs into shards for running them
+on several machines, balanced by durations saved in previous runs if given.
+*/
+
+#ifndef _SHARD_EXT_H_
+#define _SHARD_EXT_H_
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include "lightest.h"
+
+namespace lightest {
+
+/* ========== Sharding ========== */
+
+// Marks a shard index or count not given by SHARD(index, count) or flags
+const unsigned int shardUnset = UINT_MAX;
+// Use SHARD(index, count), or environment variables LIGHTEST_SHARD_INDEX &
+// LIGHTEST_SHARD_COUNT, to only run the index-th of count shards of TESTs
+LIGHTEST_EXTERN unsigned int shardIndex LIGHTEST_INIT(= shardUnset);
+LIGHTEST_EXTERN unsigned int shardCount LIGHTEST_INIT(= shardUnset);
+// Use SHARD_DURATIONS(file) to balance shards by durations of TESTs saved by
+// SAVE_DURATIONS(file) in previous runs
+LIGHTEST_EXTERN string shardDurationsFile;
+
+// Environment variables only give what CONFIG leaves unset
+inline void ReadShardEnv() {
+  const char* index = getenv("LIGHTEST_SHARD_INDEX");
+  const char* count = getenv("LIGHTEST_SHARD_COUNT");
+  if (shardIndex == shardUnset) {
+    shardIndex = index != nullptr
+                     ? ParseCount("LIGHTEST_SHARD_INDEX", index, shardUnset - 1)
+                     : 0;
+  }
+  if (shardCount == shardUnset) {
+    shardCount = count != nullptr
+                     ? ParseCount("LIGHTEST_SHARD_COUNT", count, shardUnset - 1)
+                     : 1;
+  }
+}
+
+// Assign tests to shards by their durations, longest processing time first:
+// every test goes to the shard with the least total duration. All shards
+// compute the same assignment for ties are broken by indexes
+inline vector<unsigned int> AssignShards(const vector<double>& durations,
+                                         unsigned int count) {
+  vector<size_t> order(durations.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = i;
+  stable_sort(order.begin(), order.end(), [&durations](size_t a, size_t b) {
+    return durations[a] > durations[b];
+  });
+  vector<double> loads(count, 0);
+  vector<unsigned int> shards(durations.size());
+  for (size_t index : order) {
+    unsigned int shard = 0;
+    for (unsigned int i = 1; i < count; i++) {
+      if (loads[i] < loads[shard]) shard = i;
+    }
+    loads[shard] += durations[index];
+    shards[index] = shard;
+  }
+  return shards;
+}
+
+// Only keep TESTs of the current shard, dealt round-robin without durations
+// Tests without durations are taken as long as the average
+inline void Shard(Register& reg) {
+  map<string, double> saved;
+  if (!shardDurationsFile.empty()) {
+    // Shards mustn't silently go unbalanced by a mistyped file
+    ifstream file(shardDurationsFile);
+    if (!file.is_open()) {
+      cerr << "lightest: cannot read durations " << shardDurationsFile
+           << endl;
+      exit(1);
+    }
+    string name;
+    for (double duration; file >> name >> duration;) saved[name] = duration;
+  }
+  vector<unsigned int> shards(reg.GetRegisteredNum());
+  if (saved.empty()) {
+    for (size_t i = 0; i < shards.size(); i++) shards[i] = i % shardCount;
+  } else {
+    double sum = 0;
+    for (const pair<const string, double>& item : saved) sum += item.second;
+    vector<double> durations(shards.size(), sum / saved.size());
+    for (size_t i = 0; i < shards.size(); i++) {
+      map<string, double>::const_iterator item = saved.find(reg.GetName(i));
+      if (item != saved.end()) durations[i] = item->second;
+    }
+    shards = AssignShards(durations, shardCount);
+  }
+  reg.Filter([&shards](size_t index) { return shards[index] == shardIndex; });
+}
+
+// Only run TESTs of the current shard after filtering
+inline void SelectShard(Register& reg) {
+  ReadShardEnv();
+  // A mistyped shard mustn't pass by running nothing
+  if (shardCount == 0 || shardIndex >= shardCount) {
+    cerr << "lightest: invalid shard index " << shardIndex
+         << " of shard count " << shardCount << endl;
+    exit(1);
+  }
+  if (shardCount > 1) Shard(reg);
+}
+
+// Takes over selecting TESTs during static initialization
+class ShardSelecting {
+ public:
+  ShardSelecting() { testsSelector = SelectShard; }
+};
+LIGHTEST_EXTERN ShardSelecting shardSelecting;
+
+/* ========== Durations ========== */
+
+// Saves durations (ms) of TESTs at the end of the run, one "name duration"
+// each line, for SHARD_DURATIONS(file) of later runs
+class DurationsSaver : public Listener {
+ public:
+  void Open(const string& fileName) {
+    if (this->fileName.empty()) AddListener(this);
+    this->fileName = fileName;
+    keepTree = true;  // Durations are read at the end
+  }
+  void OnRunEnd(const DataSet* data) {
+    ofstream file(fileName);
+    data->IterSons([&file](const Data* item) {
+      if (item->Type() != DATA_SET) return;
+      const DataSet* test = static_cast<const DataSet*>(item);
+      file << test->GetName() << " " << test->GetDuration() << "\n";
+    });
+  }
+
+ private:
+  string fileName;
+};
+LIGHTEST_EXTERN DurationsSaver durationsSaver;
+
+};  // namespace lightest
+
+// Only run the index-th (from 0) of count shards of TESTs
+#define SHARD(index, count) \
+  lightest::shardIndex = (index), lightest::shardCount = (count);
+// Balance shards by durations saved by SAVE_DURATIONS(file) in previous runs
+#define SHARD_DURATIONS(file) lightest::shardDurationsFile = (file);
+#define SAVE_DURATIONS(file) lightest::durationsSaver.Open(file);
+
+#endif
@@ -0,0 +1,174 @@
+/*
+This is a Lightest extension, which gives TESTs and SUBs time limits by
+TIMEOUT(ms) and DEFAULT_TIMEOUT(ms). Deadlines are watched on a thread, and a
+hung TEST is reported as timed out while the run goes on without it, on the
+threads of parallel_ext.h.
+*/
+
+#ifndef _TIMEOUT_EXT_H_
+#define _TIMEOUT_EXT_H_
+
+#include <condition_variable>
+#include <thread>
+#include "lightest.h"
+#include "parallel_ext.h"
+
+namespace lightest {
+
+/* ========== Timed Out Tests ========== */
+
+// Data of a timed out test as a global test, for data of the tests may still
+// be changed by their running threads: copies of the data recorded so far by
+// the test and its parents, ending with a DataTimeout in the timed out one
+inline DataSet* TimedOutData(const Testing& testing, unsigned int limit) {
+  DataSet* data = testing.CopyData();
+  data->Add(new DataTimeout(CopyToArena(testing.GetPath()), limit));
+  data->End(testing.GetElapsed(), 0);
+  for (const Testing* parent = testing.GetParent(); parent != nullptr;
+       parent = parent->GetParent()) {
+    DataSet* parentData = parent->CopyData();
+    parentData->Add(data);
+    parentData->End(parent->GetElapsed(), 0);
+    data = parentData;
+  }
+  return data;
+}
+
+// Report the timed out test, and let the run go on without the thread of its
+// TEST. Out of a run of TESTs of parallel_ext.h (e.g. with a runner of users),
+// the thread running the test ends the run, so the test is only marked timed
+// out, and recorded so when it returns
+inline void TimedOut(Testing& testing, unsigned int limit) {
+  if (testsRun == nullptr) {
+    cerr << "lightest: " << testing.GetPath() << " timed out after " << limit
+         << " ms" << endl;
+    testing.MarkTimedOut(limit);
+    return;
+  }
+  const Testing* root = &testing;
+  while (root->GetParent() != nullptr) root = root->GetParent();
+  if (!root->Settle()) return;  // Ended meanwhile
+  testsRun->Abandon(*root, TimedOutData(testing, limit));
+}
+
+// Called on the watchdog thread when a test runs out of its time limit. The
+// default one reports its TEST as timed out, and moves on without the thread
+// running it, for the test can't be stopped in process
+// The test is blocked in Unwatch() until it returns, while other tests can
+// still set & clear their deadlines
+LIGHTEST_EXTERN void (*timeoutHandler)(Testing& testing, unsigned int limit)
+    LIGHTEST_INIT(= TimedOut);
+
+/* ========== Watchdog ========== */
+
+// Watches deadlines of running tests on a thread, which is only started by
+// the first deadline, so runs without time limits pay nothing
+class Watchdog {
+ public:
+  Watchdog()
+      : handling(nullptr), started(false), stop(false), nextWake(LLONG_MAX) {}
+  // Set or reset the deadline of a test
+  void Watch(Testing* testing, unsigned int limit) {
+    long long deadline = WallNow() + (long long)limit * 1000000;
+    lock_guard<mutex> guard(lock);
+    Remove(testing);
+    watched.push_back(Entry{testing, deadline, limit});
+    if (!started) {
+      started = true;
+      worker = thread(&Watchdog::Work, this);
+    }
+    if (deadline < nextWake) wake.notify_one();
+  }
+  // Wait for the timeout handler if it's given the test, which must live
+  // until the handler returns
+  void Unwatch(Testing* testing) {
+    unique_lock<mutex> guard(lock);
+    Remove(testing);
+    handled.wait(guard, [this, testing]() { return handling != testing; });
+  }
+  ~Watchdog() {
+    if (!started) return;
+    {
+      lock_guard<mutex> guard(lock);
+      stop = true;
+    }
+    wake.notify_one();
+    worker.join();
+  }
+
+ private:
+  typedef struct {
+    Testing* testing;
+    long long deadline;
+    unsigned int limit;
+  } Entry;
+  // Only running tests are watched, so a linear search is cheap
+  void Remove(Testing* testing) {
+    for (size_t i = 0; i < watched.size(); i++) {
+      if (watched[i].testing != testing) continue;
+      watched[i] = watched.back();
+      watched.pop_back();
+      return;
+    }
+  }
+  void Work() {
+    unique_lock<mutex> guard(lock);
+    while (!stop) {
+      long long now = WallNow();
+      nextWake = LLONG_MAX;
+      for (size_t i = 0; i < watched.size(); i++) {
+        if (watched[i].deadline > now) {
+          if (watched[i].deadline < nextWake) nextWake = watched[i].deadline;
+          continue;
+        }
+        Entry entry = watched[i];
+        Remove(entry.testing);
+        // Handled out of the lock, so that other tests aren't blocked
+        handling = entry.testing;
+        guard.unlock();
+        timeoutHandler(*entry.testing, entry.limit);
+        guard.lock();
+        handling = nullptr;
+        handled.notify_all();
+        nextWake = now;  // Check again
+        break;
+      }
+      if (nextWake == now) continue;
+      if (nextWake == LLONG_MAX) {
+        wake.wait(guard);
+      } else {
+        wake.wait_for(guard, chrono::nanoseconds(nextWake - now));
+      }
+    }
+  }
+  vector<Entry> watched;
+  mutex lock;
+  condition_variable wake;
+  Testing* handling;  // Test given to the timeout handler
+  condition_variable handled;
+  thread worker;
+  bool started, stop;
+  long long nextWake;  // When the watchdog thread wakes up next time
+};
+LIGHTEST_EXTERN Watchdog watchdog;
+
+inline void WatchTest(Testing* testing, unsigned int limit) {
+  watchdog.Watch(testing, limit);
+}
+inline void UnwatchTest(Testing* testing) { watchdog.Unwatch(testing); }
+
+// Lets tests set their deadlines during static initialization
+class TimeoutWatching {
+ public:
+  TimeoutWatching() { watchTest = WatchTest, unwatchTest = UnwatchTest; }
+};
+LIGHTEST_EXTERN TimeoutWatching timeoutWatching;
+
+};  // namespace lightest
+
+// Time limit (ms) of every TEST and SUB, or use TIMEOUT(ms) in one of them
+#define DEFAULT_TIMEOUT(ms) lightest::defaultTimeout = (ms);
+// Time limit (ms) of the current TEST or SUB including its sub tests
+#define TIMEOUT(ms) testing.SetTimeout(ms)
+
+#endif
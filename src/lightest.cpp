@@ -0,0 +1,23 @@
+/*
+Definitions of global variables and main of Lightest and its extensions, for
+lightest::library. Test files linked with it are compiled with
+LIGHTEST_LIBRARY, so that they can be linked into one program.
+The performance counter extension is included on Linux, where it only records
+counters with PERF_COUNTERS() or --perf-counters.
+*/
+
+#define LIGHTEST_IMPLEMENTATION
+
+#include "lightest/archive_ext.h"
+#include "lightest/arg_config_ext.h"
+#include "lightest/benchmark_ext.h"
+#include "lightest/data_analysis_ext.h"
+#include "lightest/isolation_ext.h"
+#include "lightest/lightest.h"
+#include "lightest/parallel_ext.h"
+#ifdef __linux__
+#include "lightest/perf_counter_ext.h"
+#endif
+#include "lightest/report_ext.h"
+#include "lightest/shard_ext.h"
+#include "lightest/timeout_ext.h"
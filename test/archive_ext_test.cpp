@@ -0,0 +1,85 @@
+#include <lightest/archive_ext.h>
+#include <lightest/arg_config_ext.h>
+#include <lightest/lightest.h>
+#include <lightest/report_ext.h>
+
+#include <cmath>
+#include <cstring>
+
+#undef TEST_FILE_NAME
+#define TEST_FILE_NAME "archive_ext_test.cpp"
+
+ARG_CONFIG();
+
+CONFIG(Archive) { ARCHIVE("archive.bin"); }
+
+TEST(TestPass) {
+  REQ(1, ==, 1);
+  SUB(SubTestPass) {
+    for (int i = 0; i < 100; i++) REQ(i, <, 100);
+  };
+}
+
+TEST(TestFail) {
+  REQ(std::string("actual"), ==, std::string("expected"));
+  SUB(SubTestFail) {
+    REQ(1, >, 2);
+    SUB(SubSubTestPass) { REQ(2, >, 1); };
+  };
+}
+
+TEST(TestError) { throw "Uncaught string error"; }
+
+// Whether two trees of data are the same, in what's archived
+bool SameData(const lightest::Data* a, const lightest::Data* b) {
+  if (a->Type() != b->Type() || a->GetFailed() != b->GetFailed() ||
+      a->GetTabs() != b->GetTabs()) {
+    return false;
+  }
+  if (a->Type() == lightest::DATA_REQ) {
+    const lightest::DataReq* reqA = static_cast<const lightest::DataReq*>(a);
+    const lightest::DataReq* reqB = static_cast<const lightest::DataReq*>(b);
+    return strcmp(reqA->GetExpr(), reqB->GetExpr()) == 0 &&
+           reqA->GetLine() == reqB->GetLine() &&
+           (!reqA->GetFailed() ||
+            strcmp(reqA->GetActual(), reqB->GetActual()) == 0);
+  }
+  if (a->Type() != lightest::DATA_SET) return true;
+  const lightest::DataSet* setA = static_cast<const lightest::DataSet*>(a);
+  const lightest::DataSet* setB = static_cast<const lightest::DataSet*>(b);
+  if (strcmp(setA->GetName(), setB->GetName()) != 0 ||
+      setA->GetSonsNum() != setB->GetSonsNum() ||
+      setA->GetReqsNum() != setB->GetReqsNum() ||
+      std::fabs(setA->GetDuration() - setB->GetDuration()) > 1e-6) {
+    return false;
+  }
+  std::vector<const lightest::Data*> sonsA, sonsB;
+  setA->IterSons([&sonsA](const lightest::Data* son) { sonsA.push_back(son); });
+  setB->IterSons([&sonsB](const lightest::Data* son) { sonsB.push_back(son); });
+  for (size_t i = 0; i < sonsA.size(); i++) {
+    if (!SameData(sonsA[i], sonsB[i])) return false;
+  }
+  return true;
+}
+
+// The archive is written before DATA
+DATA(CheckArchive) {
+  lightest::ArchiveReader reader;
+  const lightest::DataSet* archived = reader.Read("archive.bin");
+  std::cout << "Archive read: " << (archived != nullptr) << std::endl;
+  std::cout << "Archive matches: "
+            << (archived != nullptr && archived->GetSonsNum() == 3 &&
+                data->GetSonsNum() == 3 && [&]() {
+                  bool same = true;
+                  std::vector<const lightest::Data*> tests;
+                  archived->IterSons([&tests](const lightest::Data* test) {
+                    tests.push_back(test);
+                  });
+                  size_t i = 0;
+                  data->IterSons([&](const lightest::Data* test) {
+                    same = same && SameData(test, tests[i++]);
+                  });
+                  return same;
+                }())
+            << std::endl;
+}
@@ -0,0 +1,51 @@
+#include <lightest/arg_config_ext.h>
+#include <lightest/benchmark_ext.h>
+#include <lightest/lightest.h>
+
+#include <vector>
+
+#undef TEST_FILE_NAME
+#define TEST_FILE_NAME "benchmark_ext_test.cpp"
+
+ARG_CONFIG();
+
+CONFIG(BenchConfig) {
+  BENCH_TARGET_TIME(20);
+  BENCH_WARMUP_TIME(2);
+}
+
+BENCH(BenchEmpty) {}
+
+BENCH(BenchVectorPush) {
+  std::vector<int> vec;
+  for (int i = 0; i < 100; i++) vec.push_back(i);
+  lightest::DoNotOptimize(vec.data());
+  lightest::ClobberMemory();
+}
+
+BENCH(BenchUncaughtError) { throw "Uncaught string error"; }
+
+TEST(TestMannWhitney) {
+  double slow[] = {11, 12, 13, 14, 15, 16, 17, 18},
+         fast[] = {1, 2, 3, 4, 5, 6, 7, 8};
+  // Slower samples are significant, while same samples are not
+  REQ(lightest::MannWhitneyP(slow, 8, fast, 8), <, 0.01);
+  REQ(lightest::MannWhitneyP(fast, 8, slow, 8), >, 0.99);
+  REQ(lightest::MannWhitneyP(fast, 8, fast, 8), >, 0.4);
+}
+
+// Check statistics of benchmarks
+DATA(CheckBenchStats) {
+  data->IterSons([](const lightest::Data* item) {
+    static_cast<const lightest::DataSet*>(item)->IterSons(
+        [](const lightest::Data* item) {
+          if (item->Type() != lightest::DATA_BENCH) return;
+          const lightest::DataBench* bench =
+              static_cast<const lightest::DataBench*>(item);
+          std::cout << "Stats in order: "
+                    << (bench->GetMin() <= bench->GetMedian() &&
+                        bench->GetMedian() <= bench->GetP99())
+                    << std::endl;
+        });
+  });
+}
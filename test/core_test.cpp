@@ -1,12 +1,41 @@
+#include <lightest/archive_ext.h>
 #include <lightest/arg_config_ext.h>
 #include <lightest/data_analysis_ext.h>
+#include <lightest/isolation_ext.h>
 #include <lightest/lightest.h>
 
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
 #undef TEST_FILE_NAME
 #define TEST_FILE_NAME "test.cpp"
 
 ARG_CONFIG();
 
+// Count events of all the tests, which may come from threads at the same time
+class CountingListener : public lightest::Listener {
+ public:
+  CountingListener() : testsNum(0), failedTestsNum(0), reqsNum(0) {}
+  void OnAssertion(lightest::Testing& testing, const lightest::DataReq& req) {
+    reqsNum++;
+  }
+  void OnTestEnd(lightest::Testing& testing) {
+    testsNum++;
+    if (testing.GetData()->GetFailed()) failedTestsNum++;
+  }
+  void OnRunEnd(const lightest::DataSet* data) {
+    std::cout << "Listened: " << testsNum << " tests, " << failedTestsNum
+              << " failed, " << reqsNum << " REQs" << std::endl;
+  }
+
+ private:
+  std::atomic<int> testsNum, failedTestsNum, reqsNum;
+};
+LISTENER(CountingListener);
+
 TEST(TestTimerMacros) {
   int i = 0;
   REQ(TIMER(i++), >=, 0);
@@ -23,6 +52,22 @@ TEST(TestAssertionMacros) {
   MUST(REQ(a, ==, c));  // FAIL & stop this test
 }
 
+TEST(TestReqOperands) {
+  std::unique_ptr<int> ptr(new int(1));
+  REQ(ptr, !=, nullptr);  // Non-copyable operands
+  REQ(ptr, ==, nullptr);  // Test fail, unprintable operands
+  REQ(std::string(1000, 'a'), ==, "a");  // Test fail, cut long operands
+}
+
+TEST(TestTimeout) {
+  TIMEOUT(10000);
+  REQ(1, ==, 1);
+  SUB(SubTestTimeout) {
+    TIMEOUT(10000);
+    REQ(1, ==, 1);
+  };
+}
+
 TEST(TestSub) {
   int a = 1;
   SUB(SubTest1) { REQ(a, ==, 1); };
@@ -46,8 +91,38 @@ TEST(TestCatchUncaughtError) {
   SUB(TestUnknown) { throw 1; };
 }
 
+TEST(TestGlobMatch) {
+  REQ(lightest::GlobMatch("Test*", "TestSub", false), ==, true);
+  REQ(lightest::GlobMatch("*/Sub?", "Test/Sub1", false), ==, true);
+  REQ(lightest::GlobMatch("Test?", "TestSub", false), ==, false);
+  // Sub tests of Test may match
+  REQ(lightest::GlobMatch("Test/Sub*", "Test/", true), ==, true);
+  REQ(lightest::GlobMatch("Other/Sub*", "Test/", true), ==, false);
+}
+
+TEST(TestAssignShards) {
+  std::vector<unsigned int> shards =
+      lightest::AssignShards({1, 5, 2, 4, 3, 3}, 2);
+  // 5 + 3 + 1 vs 4 + 3 + 2
+  REQ(shards[1], ==, 0u);
+  REQ(shards[3], ==, 1u);
+  REQ(shards[0], ==, shards[1]);
+}
+
+TEST(TestReqOnThreads) {
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.push_back(std::thread([&testing, i]() {
+      for (int j = 0; j < 100; j++) REQ(i, ==, i);
+      if (i == 0) REQ(i, ==, 1);  // Test fail
+    }));
+  }
+  for (std::thread& item : threads) item.join();
+}
+
 REPORT() {
   REPORT_FAILED_TESTS();
   REPORT_PASS_RATE();
+  REPORT_REQ_PASS_RATE();
   REPORT_AVG_TIME();
 }
\ No newline at end of file
@@ -8,7 +8,10 @@
 ARG_CONFIG();
 
 // Small tests to provide test data
-TEST(Test1) { REQ(1, ==, 1); }
+TEST(Test1) {
+  REQ(1, ==, 1);
+  REQ(2, ==, 2);
+}
 TEST(Test2) { REQ(1, ==, 2); }
 TEST(Test3) {
   SUB(SubTest) {
@@ -33,9 +36,62 @@ DATA(IterFailedTests) {
   std::cout << "Test IterFailedTests: Failures: " << failureCount << std::endl;
 }
 
+// Test iterating by range-based for, in the order of outputs
+DATA(IterRanges) {
+  std::cout << "Test AllTests:";
+  for (const lightest::DataSet* test : lightest::AllTests(data)) {
+    std::cout << " " << test->GetName();
+  }
+  std::cout << "\nTest FailedTests:";
+  for (const lightest::DataSet* test : lightest::FailedTests(data)) {
+    std::cout << " " << test->GetName();
+  }
+  std::cout << std::endl;
+}
+
+// Test aggregates kept on DataSets, compared with walking the tree
+DATA(Aggregates) {
+  unsigned int testsNum = 0, failedNum = 0;
+  for (const lightest::DataSet* test : lightest::AllTests(data)) {
+    testsNum++;
+    if (test->GetFailed()) failedNum++;
+  }
+  std::cout << "Test Aggregates: Tests: " << data->GetSubsNum() << "/"
+            << data->GetAllSubsNum() << " (walked " << testsNum
+            << "), failed: " << data->GetFailedSubsNum() << "/"
+            << data->GetAllFailedSubsNum() << " (walked " << failedNum
+            << "), REQs: " << data->GetAllFailedReqsNum() << "/"
+            << data->GetAllReqsNum() << " failed" << std::endl;
+}
+
+// Test PassRate & Average, which are 100 & 0 for none instead of NaN
+DATA(PassRate) {
+  std::cout << "Test PassRate: " << lightest::PassRate(1, 4) << "%, none "
+            << lightest::PassRate(0, 0) << "%, Average: "
+            << lightest::Average(3, 2) << ", none " << lightest::Average(3, 0)
+            << std::endl;
+}
+
+// Test DurationStats, with times stable enough to check the order only
+DATA(DurationStats) {
+  lightest::DurationStats stats(data, 2);
+  std::cout << "Test DurationStats: Tests: " << stats.GetTestsNum()
+            << ", slowest: " << stats.GetSlowest().size() << ", in order: "
+            << (stats.GetSlowest()[0].duration >=
+                        stats.GetSlowest()[1].duration &&
+                    stats.GetPercentile(0.5) <= stats.GetPercentile(0.99) &&
+                    stats.GetPercentile(1) == stats.GetMaxDuration()
+                ? "yes"
+                : "no")
+            << std::endl;
+}
+
 // Test REPORT
 REPORT() {
   REPORT_FAILED_TESTS();
   REPORT_PASS_RATE();
+  REPORT_REQ_PASS_RATE();
   REPORT_AVG_TIME();
+  REPORT_SLOWEST(3);
+  REPORT_DURATIONS();
 }
\ No newline at end of file
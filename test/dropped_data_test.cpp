@@ -0,0 +1,47 @@
+#include <lightest/lightest.h>
+#include <lightest/parallel_ext.h>
+
+#include <thread>
+
+#undef TEST_FILE_NAME
+#define TEST_FILE_NAME "dropped_data_test.cpp"
+
+// Without default outputs & DATA, data of TESTs are dropped as they end, and
+// only counted in the per-thread collectors. The run must still fail
+CONFIG(DroppedDataConfig) {
+  NO_OUTPUT();
+  PARALLEL(4);
+}
+
+TEST(TestPass) { REQ(1, ==, 1); }
+
+TEST(TestFail) { REQ(1, ==, 2); }
+
+TEST(TestSubFail) {
+  SUB(SubTestFail) { REQ(1, ==, 2); };
+}
+
+TEST(TestPassToo) { REQ(2, ==, 2); }
+
+// Data of REQs on other threads are in the arenas of the threads, so the data
+// of the TEST are kept instead of dropped
+TEST(TestFailOnThread) {
+  std::thread([&testing]() { REQ(1, ==, 2); }).join();
+}
+
+// Counts merged from the collectors, without keeping the data
+class DroppedDataChecker : public lightest::Listener {
+ public:
+  void OnRunEnd(const lightest::DataSet* data) {
+    std::cout << "Failed: " << data->GetFailed() << ", failed tests: "
+              << data->GetFailedSubsNum() << " of " << data->GetSubsNum()
+              << std::endl;
+    data->IterSons([](const lightest::Data* item) {
+      const lightest::DataSet* test =
+          static_cast<const lightest::DataSet*>(item);
+      std::cout << "Kept: " << test->GetName() << " with "
+                << test->GetFailedReqsNum() << " failed REQs" << std::endl;
+    });
+  }
+};
+LISTENER(DroppedDataChecker);
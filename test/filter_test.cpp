@@ -0,0 +1,28 @@
+#include <lightest/lightest.h>
+
+#undef TEST_FILE_NAME
+#define TEST_FILE_NAME "filter_test.cpp"
+
+// A filter only matching a SUB runs its parent to define it, but only records
+// data of the SUB, so the failing REQs of the parent & the other SUB aren't
+// recorded. The run must succeed
+CONFIG(FilterConfig) { FILTER("TestParent/SubSelected"); }
+
+TEST(TestParent) {
+  REQ(1, ==, 2);
+  SUB(SubSelected) { REQ(1, ==, 1); };
+  SUB(SubOther) { REQ(1, ==, 2); };
+  REQ(2, ==, 3);
+}
+
+TEST(TestOther) { REQ(1, ==, 2); }
+
+// The parent is kept for the structure, with no data of its own
+DATA(CheckFilteredData) {
+  data->IterSons([](const lightest::Data* item) {
+    const lightest::DataSet* test = static_cast<const lightest::DataSet*>(item);
+    std::cout << "Kept: " << test->GetName() << " with " << test->GetReqsNum()
+              << " REQs of its own, " << test->GetAllReqsNum()
+              << " REQs in total" << std::endl;
+  });
+}
@@ -0,0 +1,113 @@
+#include <lightest/arg_config_ext.h>
+#include <lightest/benchmark_ext.h>
+#include <lightest/data_analysis_ext.h>
+#include <lightest/isolation_ext.h>
+#include <lightest/lightest.h>
+#include <lightest/report_ext.h>
+
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#undef TEST_FILE_NAME
+#define TEST_FILE_NAME "isolation_ext_test.cpp"
+
+ARG_CONFIG();
+
+CONFIG(IsolationConfig) {
+  ISOLATION();
+  PARALLEL(4);
+  // A baseline far faster than BenchRegressed can be
+  std::ofstream baseline("isolation_baseline.txt");
+  baseline << "BenchRegressed";
+  for (int i = 0; i < 20; i++) baseline << " 0.001";
+  baseline << "\n";
+  baseline.close();  // The baseline is read when it's set
+  BENCH_BASELINE("isolation_baseline.txt");
+  BENCH_TARGET_TIME(5);
+  BENCH_WARMUP_TIME(1);
+}
+
+TEST(TestPass) {
+  REQ(1, ==, 1);
+  SUB(SubTestFail) { REQ(1 + 1, ==, 3); };
+}
+
+TEST(TestSegfault) {
+  REQ(1, ==, 1);
+  std::raise(SIGSEGV);
+}
+
+TEST(TestExit) { std::exit(3); }
+
+TEST(TestUncaughtError) { throw "Uncaught string error"; }
+
+TEST(TestTimeout) {
+  TIMEOUT(100);
+  REQ(1, ==, 1);
+  SUB(SubTestHang) {
+    while (true) std::this_thread::sleep_for(std::chrono::seconds(1));
+  };
+}
+
+TEST(TestInTime) {
+  TIMEOUT(10000);
+  REQ(1, ==, 1);
+}
+
+#if defined(__linux__) || defined(__APPLE__)
+// Workers ignore no signals users don't
+TEST(TestSigpipeHandler) {
+  struct sigaction handler;
+  sigaction(SIGPIPE, nullptr, &handler);
+  REQ(handler.sa_handler == SIG_DFL, ==, true);
+}
+
+// Its watchdog can't report the timeout, so the parent kills its worker
+TEST(TestTimeoutUnreported) {
+  TIMEOUT(100);
+  std::lock_guard<std::mutex> guard(lightest::workerResultLock);
+  while (true) std::this_thread::sleep_for(std::chrono::seconds(1));
+}
+#endif
+
+TEST(TestAfterCrashes) {
+  for (int i = 0; i < 10; i++) REQ(i, <, 10);
+}
+
+// Fails by its regression, which is sent back with the benchmark
+BENCH(BenchRegressed) {
+  int sum = 0;
+  for (int i = 0; i < 100; i++) sum += i;
+  lightest::DoNotOptimize(sum);
+}
+
+// Tests are recorded in order, with crashes and timeouts in place of their
+// data
+DATA(CheckIsolation) {
+  lightest::IterAllTests(data, [](const lightest::DataSet* item) {
+    item->IterSons([item](const lightest::Data* son) {
+      if (son->Type() == lightest::DATA_CRASH) {
+        const lightest::DataCrash* crash =
+            static_cast<const lightest::DataCrash*>(son);
+        std::cout << item->GetName() << " crashed by signal "
+                  << crash->GetSignal() << " with exit code "
+                  << crash->GetExitCode() << std::endl;
+      } else if (son->Type() == lightest::DATA_TIMEOUT) {
+        std::cout << static_cast<const lightest::DataTimeout*>(son)->GetPath()
+                  << " timed out" << std::endl;
+      } else if (son->Type() == lightest::DATA_BENCH_REGRESSION) {
+        std::cout << item->GetName() << " regressed, failed: "
+                  << item->GetFailed() << std::endl;
+      }
+    });
+  });
+}
+
+REPORT() {
+  REPORT_FAILED_TESTS();
+  REPORT_REQ_PASS_RATE();
+}
@@ -0,0 +1,36 @@
+// Linked with the other library tests and lightest::library into one program
+#include <lightest/arg_config_ext.h>
+#include <lightest/data_analysis_ext.h>
+#include <lightest/lightest.h>
+
+#undef TEST_FILE_NAME
+#define TEST_FILE_NAME "library_test.cpp"
+
+ARG_CONFIG();
+
+class FileListener : public lightest::Listener {
+ public:
+  FileListener() : testsNum(0) {}
+  void OnTestData(const lightest::DataSet* data) { testsNum++; }
+  void OnRunEnd(const lightest::DataSet* data) {
+    lightest::Output() << "Listened: " << testsNum << " tests\n";
+  }
+
+ private:
+  std::atomic<unsigned int> testsNum;
+};
+LISTENER(FileListener);
+
+TEST(TestInThisFile) {
+  REQ(1, ==, 1);
+  SUB(SubTest) { REQ(2, ==, 2); };
+}
+
+// Tests of both the files are run
+DATA(CheckTests) {
+  lightest::IterAllTests(data, [](const lightest::DataSet* item) {
+    std::cout << "Ran " << item->GetName() << std::endl;
+  });
+}
+
+REPORT() { REPORT_PASS_RATE(); }
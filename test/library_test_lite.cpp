@@ -0,0 +1,23 @@
+// Linked with the other library tests and lightest::library, only using the
+// slim header
+#include <lightest/lightest_lite.h>
+
+#include <string>
+
+#undef TEST_FILE_NAME
+#define TEST_FILE_NAME "library_test_lite.cpp"
+
+struct Unprintable {
+  bool operator==(const Unprintable&) const { return false; }
+};
+
+TEST(TestWithSlimHeader) {
+  REQ(std::string("lite"), ==, "lite");
+  REQ(1, <, 2);
+  SUB(SubFailed) {
+    REQ(Unprintable(), ==, Unprintable());  // Failed
+  };
+  SUB(SubThrowing) { throw "Thrown in SUB"; };
+  MUST(REQ(1, !=, 1));  // Failed
+  REQ(3, ==, 4);        // Never reached
+}
@@ -0,0 +1,22 @@
+// Linked with the other library tests and lightest::library into one program
+#include <lightest/benchmark_ext.h>
+#include <lightest/lightest.h>
+#include <lightest/report_ext.h>
+
+#undef TEST_FILE_NAME
+#define TEST_FILE_NAME "library_test_more.cpp"
+
+CONFIG(MoreConfig) {
+  BENCH_TARGET_TIME(10);
+  BENCH_WARMUP_TIME(1);
+  REPORT_JSON("library_test.jsonl");
+}
+
+TEST(TestInAnotherFile) {
+  REQ(1, ==, 2);  // Failed
+}
+
+BENCH(BenchInAnotherFile) {
+  volatile int sum = 0;
+  for (int i = 0; i < 100; i++) sum += i;
+}
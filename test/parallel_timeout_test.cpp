@@ -0,0 +1,72 @@
+#include <lightest/lightest.h>
+#include <lightest/parallel_ext.h>
+#include <lightest/timeout_ext.h>
+
+#include <chrono>
+#include <thread>
+
+#undef TEST_FILE_NAME
+#define TEST_FILE_NAME "parallel_timeout_test.cpp"
+
+// A TEST waiting for its parallel SUBs must only help running its own SUBs,
+// and never the other TESTs of the run, which would run out of its time
+// limit. The run must succeed
+CONFIG(ParallelTimeoutConfig) {
+  PARALLEL(40);
+  PARALLEL_SUB();
+}
+
+#define SLEEP_MS(ms) std::this_thread::sleep_for(std::chrono::milliseconds(ms))
+
+#define SUBS_TEST(name)                  \
+  TEST(name) {                           \
+    TIMEOUT(60);                         \
+    SUB(Sub1) { SLEEP_MS(5); };          \
+    SUB(Sub2) { SLEEP_MS(5); };          \
+    SUB(Sub3) { SLEEP_MS(5); };          \
+    SUB(Sub4) { SLEEP_MS(5); };          \
+    SUB(Sub5) { SLEEP_MS(5); };          \
+    SUB(Sub6) { SLEEP_MS(5); };          \
+    SUB(Sub7) { SLEEP_MS(5); };          \
+    SUB(Sub8) { SLEEP_MS(5); };          \
+  }
+
+#define SLOW_TEST(name) \
+  TEST(name) { SLEEP_MS(100); }
+
+SUBS_TEST(TestSubs1)
+SUBS_TEST(TestSubs2)
+SUBS_TEST(TestSubs3)
+SUBS_TEST(TestSubs4)
+SLOW_TEST(TestSlow1)
+SLOW_TEST(TestSlow2)
+SLOW_TEST(TestSlow3)
+SLOW_TEST(TestSlow4)
+SLOW_TEST(TestSlow5)
+SLOW_TEST(TestSlow6)
+SLOW_TEST(TestSlow7)
+SLOW_TEST(TestSlow8)
+SLOW_TEST(TestSlow9)
+SLOW_TEST(TestSlow10)
+SLOW_TEST(TestSlow11)
+SLOW_TEST(TestSlow12)
+SLOW_TEST(TestSlow13)
+SLOW_TEST(TestSlow14)
+SLOW_TEST(TestSlow15)
+SLOW_TEST(TestSlow16)
+SLOW_TEST(TestSlow17)
+SLOW_TEST(TestSlow18)
+SLOW_TEST(TestSlow19)
+SLOW_TEST(TestSlow20)
+SLOW_TEST(TestSlow21)
+SLOW_TEST(TestSlow22)
+SLOW_TEST(TestSlow23)
+SLOW_TEST(TestSlow24)
+SLOW_TEST(TestSlow25)
+SLOW_TEST(TestSlow26)
+SLOW_TEST(TestSlow27)
+SLOW_TEST(TestSlow28)
+SLOW_TEST(TestSlow29)
+SLOW_TEST(TestSlow30)
+SLOW_TEST(TestSlow31)
+SLOW_TEST(TestSlow32)
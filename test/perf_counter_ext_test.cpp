@@ -0,0 +1,41 @@
+#include <lightest/arg_config_ext.h>
+#include <lightest/data_analysis_ext.h>
+#include <lightest/lightest.h>
+#include <lightest/perf_counter_ext.h>
+
+#undef TEST_FILE_NAME
+#define TEST_FILE_NAME "perf_counter_ext_test.cpp"
+
+ARG_CONFIG();
+
+TEST(TestLoop) {
+  volatile int sum = 0;
+  for (int i = 0; i < 100000; i++) sum += i;
+  REQ(sum, !=, 0);
+  SUB(SubTestLoop) {
+    volatile int sum = 0;
+    for (int i = 0; i < 1000; i++) sum += i;
+    REQ(sum, !=, 0);
+  };
+}
+
+// Tests get counters if and only if they're available
+DATA(CheckPerfCounters) {
+  bool available = lightest::ThreadPerfCounters().Available();
+  lightest::IterAllTests(data, [available](const lightest::DataSet* item) {
+    std::cout << item->GetName() << " got counters as expected: "
+              << ((lightest::GetPerfCounters(item) != nullptr) == available)
+              << std::endl;
+  });
+}
+
+// Print counters given, skipping unavailable ones
+DATA(PrintPerfCounters) {
+  const unsigned long long values[] = {200, 300, 0, 4};
+  const bool has[] = {true, true, false, true};
+  lightest::DataPerfCounters counters(values, has);
+  counters.SetTabs(1);
+  counters.Print();
+}
+
+REPORT() { REPORT_PERF_COUNTERS(); }
@@ -0,0 +1,61 @@
+#include <lightest/arg_config_ext.h>
+#include <lightest/isolation_ext.h>
+#include <lightest/lightest.h>
+#include <lightest/report_ext.h>
+
+#include <fstream>
+#include <string>
+
+#undef TEST_FILE_NAME
+#define TEST_FILE_NAME "report_ext_test.cpp"
+
+ARG_CONFIG();
+
+CONFIG(Reports) {
+  REPORT_JUNIT("report.xml");
+  REPORT_JSON("report.jsonl");
+  REPORT_TAP("report.tap");
+}
+
+TEST(TestPass) {
+  REQ(1, ==, 1);
+  SUB(SubTestPass) { REQ(2, ==, 2); };
+}
+
+TEST(TestFail) {
+  REQ(std::string("<a & \"b\">"), ==, std::string("\\c\n"));
+  SUB(SubTestPass) { REQ(2, ==, 2); };
+  SUB(SubTestFail) { REQ(1, >, 2); };
+}
+
+TEST(TestError) {
+  REQ(1, ==, 1);
+  throw std::runtime_error("Unexpected");
+}
+
+// Failures of data from extensions are described by their types
+TEST(TestCrashData) { testing.AddData(new lightest::DataCrash(0, 3)); }
+
+// Reports are finished before DATA
+DATA(CheckReports) {
+  const char* files[] = {"report.xml", "report.jsonl", "report.tap"};
+  for (const char* file : files) {
+    std::ifstream report(file);
+    std::string line, last;
+    unsigned int linesNum = 0;
+    while (std::getline(report, line)) last = line, linesNum++;
+    std::cout << file << ": " << linesNum << " lines, ending with " << last
+              << std::endl;
+  }
+}
+
+// Failures directly in TESTs, as written to reports
+DATA(CheckFailures) {
+  data->IterSons([](const lightest::Data* item) {
+    const lightest::DataSet* test = static_cast<const lightest::DataSet*>(item);
+    for (const lightest::Failure& failure : lightest::GetFailures(test)) {
+      std::cout << test->GetName() << ": " << failure.kind << ": "
+                << failure.message << std::endl;
+    }
+  });
+}
@@ -0,0 +1,43 @@
+#include <lightest/lightest.h>
+#include <lightest/timeout_ext.h>
+
+#include <chrono>
+#include <thread>
+
+#undef TEST_FILE_NAME
+#define TEST_FILE_NAME "runner_timeout_test.cpp"
+
+// Out of the runner of parallel_ext.h, a TEST running out of its time limit
+// is recorded as timed out when it returns, and the run goes on on the main
+// thread. The run only succeeds if the checker finds it
+CONFIG(RunnerTimeoutConfig) {
+  lightest::testsRunner = [](lightest::Register& reg) {
+    reg.RunRegistered();
+  };
+}
+
+TEST(TestSlow) {
+  TIMEOUT(50);
+  REQ(1, ==, 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+}
+
+TEST(TestAfterSlow) { REQ(1, ==, 1); }
+
+class RunnerTimeoutChecker : public lightest::Listener {
+ public:
+  void OnRunEnd(const lightest::DataSet* data) {
+    unsigned int testsNum = 0, timeoutsNum = 0;
+    data->IterSons([&](const lightest::Data* test) {
+      testsNum++;
+      static_cast<const lightest::DataSet*>(test)->IterSons(
+          [&timeoutsNum](const lightest::Data* item) {
+            if (item->Type() == lightest::DATA_TIMEOUT) timeoutsNum++;
+          });
+    });
+    std::cout << "Tests: " << testsNum << ", timeouts: " << timeoutsNum
+              << std::endl;
+    lightest::failedReturnNoneZero = !(testsNum == 2 && timeoutsNum == 1);
+  }
+};
+LISTENER(RunnerTimeoutChecker);
@@ -0,0 +1,53 @@
+#include <lightest/lightest.h>
+#include <lightest/timeout_ext.h>
+
+#include <chrono>
+#include <thread>
+
+#undef TEST_FILE_NAME
+#define TEST_FILE_NAME "timeout_data_test.cpp"
+
+// TESTs running out of their time limits are reported with the data recorded
+// before, e.g. failures. The run only succeeds if the checker finds them
+CONFIG(TimeoutDataConfig) { DEFAULT_TIMEOUT(100); }
+
+#define HANG() \
+  while (true) std::this_thread::sleep_for(std::chrono::seconds(1))
+
+TEST(TestHangInSub) {
+  REQ(1, ==, 2);  // Test fail
+  SUB(SubTestDone) {
+    REQ(1, ==, 2);  // Test fail
+  };
+  SUB(SubTestHang) { HANG(); };
+}
+
+TEST(TestHangAfterThread) {
+  std::thread([&testing]() {
+    REQ(1, ==, 2);  // Test fail, buffered on the thread
+  }).join();
+  HANG();
+}
+
+// Whether the failures before the hangs are kept
+class TimeoutDataChecker : public lightest::Listener {
+ public:
+  void OnRunEnd(const lightest::DataSet* data) {
+    unsigned int failedReqsNum = 0, failedSubsNum = 0, timeoutsNum = 0;
+    data->IterSons([&](const lightest::Data* test) {
+      if (test->Type() != lightest::DATA_SET) return;
+      const lightest::DataSet* set =
+          static_cast<const lightest::DataSet*>(test);
+      failedReqsNum += set->GetAllFailedReqsNum();
+      failedSubsNum += set->GetAllFailedSubsNum();
+      set->IterSons([&timeoutsNum](const lightest::Data* item) {
+        if (item->Type() == lightest::DATA_TIMEOUT) timeoutsNum++;
+      });
+    });
+    std::cout << "Failed REQs: " << failedReqsNum << ", failed SUBs: "
+              << failedSubsNum << ", timeouts: " << timeoutsNum << std::endl;
+    bool kept = failedReqsNum == 3 && failedSubsNum == 1 && timeoutsNum == 2;
+    lightest::failedReturnNoneZero = !kept;
+  }
+};
+LISTENER(TimeoutDataChecker);